@@ -0,0 +1,120 @@
+#include "CadenceController.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+void smooth(double &average, double sample, double weight)
+{
+    average = average == 0.0 ? sample : average + weight * (sample - average);
+}
+
+} // namespace
+
+CadenceController::CadenceController(const Config &config, int initialThreads)
+    : mConfig(config),
+      mStride(clamp(config.initialStride, max(config.minStride, 1),
+                    max(config.maxStride, 1))),
+      mThreads(initialThreads), mLastUpdate(chrono::steady_clock::now())
+{
+}
+
+void CadenceController::recordFrame(double frameMs)
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        smooth(mFrameMs, frameMs, SMOOTHING);
+    }
+    if (chrono::steady_clock::now() - mLastUpdate >= UPDATE_INTERVAL)
+        update();
+}
+
+void CadenceController::recordInference(double inferenceMs,
+                                        double resultLatencyMs)
+{
+    lock_guard<mutex> lock(mMutex);
+    smooth(mInferenceMs, inferenceMs, SMOOTHING);
+    smooth(mResultLatencyMs, resultLatencyMs, SMOOTHING);
+}
+
+void CadenceController::update()
+{
+    lock_guard<mutex> lock(mMutex);
+    mLastUpdate = chrono::steady_clock::now();
+    if (mFrameMs <= 0.0 || mInferenceMs <= 0.0)
+        return;
+
+    const int stride = mStride.load(memory_order_relaxed);
+    const double fps = 1000.0 / mFrameMs;
+
+    // Smallest stride at which the interpreter keeps up with the camera.
+    int wanted = static_cast<int>(ceil(mInferenceMs / mFrameMs));
+    if (mConfig.targetFps > 0.0) {
+        if (fps < 0.95 * mConfig.targetFps)
+            wanted = max(wanted, stride + 1);
+        else if (fps < 1.1 * mConfig.targetFps)
+            wanted = max(wanted, stride); // Inside the dead band, hold.
+    }
+    if (mConfig.targetLatencyMs > 0.0 && mResultLatencyMs > 0.0) {
+        // Threads are added first while there are any left to add.
+        const bool moreThreads =
+            mConfig.adjustThreads &&
+            mThreads.load(memory_order_relaxed) < mConfig.maxThreads;
+        if (mResultLatencyMs > mConfig.targetLatencyMs && !moreThreads)
+            wanted = max(wanted, stride + 1);
+        else if (mResultLatencyMs > 0.6 * mConfig.targetLatencyMs)
+            wanted = max(wanted, stride);
+    }
+    // Step down one at a time so a single fast frame doesn't cause flapping.
+    wanted = max(wanted, stride - 1);
+    wanted = clamp(wanted, max(mConfig.minStride, 1), mConfig.maxStride);
+    if (wanted != stride) {
+        mStride.store(wanted, memory_order_relaxed);
+        ++mStrideChanges;
+    }
+
+    if (mConfig.adjustThreads && mConfig.targetLatencyMs > 0.0) {
+        int threads = mThreads.load(memory_order_relaxed);
+        if (mResultLatencyMs > mConfig.targetLatencyMs &&
+            threads < mConfig.maxThreads)
+            ++threads;
+        else if (mResultLatencyMs < 0.6 * mConfig.targetLatencyMs &&
+                 threads > mConfig.minThreads)
+            --threads;
+        if (threads != mThreads.load(memory_order_relaxed)) {
+            mThreads.store(threads, memory_order_relaxed);
+            ++mThreadChanges;
+        }
+    }
+}
+
+CadenceController::Metrics CadenceController::getMetrics() const
+{
+    lock_guard<mutex> lock(mMutex);
+    Metrics metrics;
+    metrics.stride = mStride.load(memory_order_relaxed);
+    metrics.threads = mThreads.load(memory_order_relaxed);
+    metrics.fps = mFrameMs > 0.0 ? 1000.0 / mFrameMs : 0.0;
+    metrics.frameMs = mFrameMs;
+    metrics.inferenceMs = mInferenceMs;
+    metrics.resultLatencyMs = mResultLatencyMs;
+    metrics.strideChanges = mStrideChanges;
+    metrics.threadChanges = mThreadChanges;
+    return metrics;
+}
+
+void CadenceController::printMetrics() const
+{
+    Metrics m = getMetrics();
+    cout << fixed << setprecision(1) << "cadence: stride " << m.stride
+         << ", threads " << m.threads << ", " << m.fps << " fps, frame "
+         << m.frameMs << " ms, inference " << m.inferenceMs
+         << " ms, result latency " << m.resultLatencyMs << " ms, changes "
+         << m.strideChanges << "/" << m.threadChanges << "\n"
+         << defaultfloat;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Adapts how often frames are sent to inference (the stride) and optionally
+// the interpreter's thread count, to hold a frame rate and/or a latency
+// target on whatever host the binary runs on.
+//
+// The stride never goes below what the interpreter can keep up with, so
+// frames aren't offered faster than they can be inferred. Missing the fps
+// target raises the stride to free cores for capture and rendering. A
+// detection latency above target adds interpreter threads if allowed, and
+// raises the stride once no more threads can be added.
+class CadenceController {
+  public:
+    struct Config {
+        double targetFps = 0.0;       // Render rate to hold, 0 = ignore.
+        double targetLatencyMs = 0.0; // Capture to result, 0 = ignore.
+        int initialStride = 2;
+        int minStride = 1;
+        int maxStride = 8;
+        bool adjustThreads = false; // Only helps CPU interpreters.
+        int minThreads = 1;
+        int maxThreads = 4;
+    };
+
+    struct Metrics {
+        int stride = 1;
+        int threads = 1;
+        double fps = 0.0;
+        double frameMs = 0.0;
+        double inferenceMs = 0.0;
+        double resultLatencyMs = 0.0;
+        uint64_t strideChanges = 0;
+        uint64_t threadChanges = 0;
+    };
+
+    CadenceController(const Config &config, int initialThreads);
+
+    // Render thread: whether this frame should be offered for inference.
+    bool shouldInfer(uint64_t frameNr) const
+    {
+        return frameNr % mStride.load(std::memory_order_relaxed) == 0;
+    }
+    // Render thread: time spent on one whole frame.
+    void recordFrame(double frameMs);
+    // Inference thread: Invoke() time and capture-to-result latency.
+    void recordInference(double inferenceMs, double resultLatencyMs);
+
+    int stride() const { return mStride.load(std::memory_order_relaxed); }
+    int threads() const { return mThreads.load(std::memory_order_relaxed); }
+    Metrics getMetrics() const;
+    void printMetrics() const;
+
+  private:
+    void update();
+
+    const Config mConfig;
+    std::atomic<int> mStride;
+    std::atomic<int> mThreads;
+
+    mutable std::mutex mMutex;
+    double mFrameMs = 0.0;
+    double mInferenceMs = 0.0;
+    double mResultLatencyMs = 0.0;
+    uint64_t mStrideChanges = 0;
+    uint64_t mThreadChanges = 0;
+    std::chrono::steady_clock::time_point mLastUpdate;
+
+    constexpr static double SMOOTHING = 0.1; // EWMA weight of new samples.
+    constexpr static std::chrono::milliseconds UPDATE_INTERVAL{500};
+};
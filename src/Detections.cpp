@@ -0,0 +1,96 @@
+#include "Detections.h"
+#include "utils.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+Detections decode(const float *boxes, const float *classes,
+                  const float *scores, size_t available, float count)
+{
+    Detections detections;
+    detections.count =
+        min({available, static_cast<size_t>(max(count, 0.f)),
+             Detections::MAX_DETECTIONS});
+
+    for (size_t i = 0; i < detections.count; ++i) {
+        detections.boxes[i] = {boxes[4 * i], boxes[4 * i + 1],
+                               boxes[4 * i + 2], boxes[4 * i + 3]};
+        detections.classes[i] = static_cast<int>(classes[i]);
+        detections.scores[i] = scores[i];
+        detections.trackIds[i] = -1;
+    }
+    return detections;
+}
+
+} // namespace
+
+Detections decodeDetections(const vector<TfLiteTensor *> &outputs)
+{
+    if (outputs.size() < 4)
+        errExit("Expected 4 detection outputs, got " +
+                to_string(outputs.size()));
+    for (const auto *o : outputs)
+        if (o->type != kTfLiteFloat32)
+            errExit("cannot handle output type " + to_string(o->type) +
+                    " yet");
+
+    TfLiteIntArray *dims = outputs[2]->dims;
+    size_t available = dims->data[dims->size - 1];
+    return decode(outputs[0]->data.f, outputs[1]->data.f, outputs[2]->data.f,
+                  available, outputs[3]->data.f[0]);
+}
+
+Detections decodeDetections(const InferenceResult &result)
+{
+    const auto &outputs = result.outputs;
+    if (outputs.size() < 4)
+        errExit("Expected 4 detection outputs, got " +
+                to_string(outputs.size()));
+    for (const auto &o : outputs)
+        if (o.type != kTfLiteFloat32)
+            errExit("cannot handle output type " + to_string(o.type) +
+                    " yet");
+
+    size_t available = outputs[2].dims.back();
+    return decode(outputs[0].as<float>(), outputs[1].as<float>(),
+                  outputs[2].as<float>(), available,
+                  outputs[3].as<float>()[0]);
+}
+
+float iou(const BoundingBox &a, const BoundingBox &b)
+{
+    float h = min(a.bottom, b.bottom) - max(a.top, b.top);
+    float w = min(a.right, b.right) - max(a.left, b.left);
+    if (h <= 0.f || w <= 0.f)
+        return 0.f;
+
+    float intersection = h * w;
+    float areaA = (a.bottom - a.top) * (a.right - a.left);
+    float areaB = (b.bottom - b.top) * (b.right - b.left);
+    return intersection / (areaA + areaB - intersection);
+}
+
+vector<Detection> nms(vector<Detection> detections, float iouThreshold)
+{
+    sort(detections.begin(), detections.end(),
+         [](const Detection &a, const Detection &b) {
+             return a.score > b.score;
+         });
+
+    vector<Detection> kept;
+    for (const auto &d : detections) {
+        bool suppressed = false;
+        for (const auto &k : kept) {
+            if (k.classId == d.classId && iou(k.box, d.box) > iouThreshold) {
+                suppressed = true;
+                break;
+            }
+        }
+        if (!suppressed)
+            kept.push_back(d);
+    }
+    return kept;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "TfLite.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounding box in normalised [0, 1] image coordinates.
+struct BoundingBox {
+    float top = 0.f;
+    float left = 0.f;
+    float bottom = 0.f;
+    float right = 0.f;
+};
+
+// Decoded output of an SSD style detection model.
+//
+// Fixed size and trivially copyable, so it can be published between threads
+// without allocating.
+struct Detections {
+    constexpr static size_t MAX_DETECTIONS = 100;
+
+    size_t count = 0;
+    uint64_t frameNr = 0;
+    std::array<BoundingBox, MAX_DETECTIONS> boxes;
+    std::array<int, MAX_DETECTIONS> classes;
+    std::array<float, MAX_DETECTIONS> scores;
+    // Filled in by IouTracker, -1 when untracked.
+    std::array<int, MAX_DETECTIONS> trackIds;
+};
+
+// A single detection, for result sets that don't fit in Detections.
+struct Detection {
+    BoundingBox box;
+    int classId = 0;
+    float score = 0.f;
+};
+
+// Decodes the four outputs of COCO SSD MobileNet v1 style models:
+// 0. Locations: [N][4] floats as [top, left, bottom, right] in [0, 1].
+// 1. Classes: N class indices stored as floats.
+// 2. Scores: N floats in [0, 1].
+// 3. Number of detections: one float.
+Detections decodeDetections(const std::vector<TfLiteTensor *> &outputs);
+Detections decodeDetections(const InferenceResult &result);
+
+// Intersection over union of two boxes, 0 if they don't overlap.
+float iou(const BoundingBox &a, const BoundingBox &b);
+
+// Greedy per-class non-maximum suppression: keeps the best scoring boxes and
+// drops those overlapping a kept box of the same class by more than
+// iouThreshold. Returns the kept detections sorted by score.
+std::vector<Detection> nms(std::vector<Detection> detections,
+                           float iouThreshold);
@@ -0,0 +1,96 @@
+#include "FramePyramid.h"
+
+#include "opencv2/imgproc/types_c.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+void scale(const cv::Mat &src, cv::Mat &dst, cv::Size size)
+{
+    // Area averaging doesn't alias when shrinking, but blurs when growing.
+    bool shrinking = size.width <= src.cols && size.height <= src.rows;
+    cv::resize(src, dst, size, 0, 0,
+               shrinking ? cv::INTER_AREA : cv::INTER_LINEAR);
+}
+
+} // namespace
+
+void FramePyramid::addSize(cv::Size size)
+{
+    auto it = find_if(mLevels.begin(), mLevels.end(),
+                      [size](const Level &l) { return l.size == size; });
+    if (it != mLevels.end())
+        return;
+
+    it = find_if(mLevels.begin(), mLevels.end(), [size](const Level &l) {
+        return l.size.area() < size.area();
+    });
+    Level level;
+    level.size = size;
+    mLevels.insert(it, level);
+}
+
+void FramePyramid::setFrame(const cv::Mat &bgr)
+{
+    mFrame = bgr;
+    for (auto &level : mLevels) {
+        // A view handed out for an earlier frame may still be in use. The
+        // views keep the old buffer alive, the level starts a new one.
+        if (level.users->load(memory_order_acquire) > 0) {
+            level.image = cv::Mat();
+            level.users = make_shared<atomic<int>>(0);
+        }
+        level.built = false;
+    }
+}
+
+FramePyramid::View FramePyramid::get(cv::Size size)
+{
+    auto match = [size](const Level &l) { return l.size == size; };
+    auto it = find_if(mLevels.begin(), mLevels.end(), match);
+    if (it == mLevels.end()) {
+        addSize(size);
+        it = find_if(mLevels.begin(), mLevels.end(), match);
+    }
+    const Level &level = build(it - mLevels.begin());
+
+    View view;
+    view.mImage = level.image;
+    level.users->fetch_add(1, memory_order_relaxed);
+    view.mHold = shared_ptr<void>(nullptr, [users = level.users](void *) {
+        users->fetch_sub(1, memory_order_release);
+    });
+    return view;
+}
+
+const FramePyramid::Level &FramePyramid::build(size_t level)
+{
+    Level &l = mLevels[level];
+    if (l.built)
+        return l;
+
+    // Scale from the smallest larger level that covers this one and is
+    // already built in this frame, so it is RGB already. Levels are sorted by
+    // area, so that's the nearest one. Larger levels nobody asked for aren't
+    // built just for this.
+    for (size_t i = level; i-- > 0;) {
+        const Level &src = mLevels[i];
+        if (src.built && src.size.width >= l.size.width &&
+            src.size.height >= l.size.height) {
+            scale(src.image, l.image, l.size);
+            ++mResizes;
+            l.built = true;
+            return l;
+        }
+    }
+
+    // Scale first, so the colour conversion runs on the smaller image.
+    scale(mFrame, mScaled, l.size);
+    cv::cvtColor(mScaled, l.image, CV_BGR2RGB);
+    ++mResizes;
+    l.built = true;
+    return l;
+}
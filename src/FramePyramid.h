@@ -0,0 +1,68 @@
+#pragma once
+
+#include "opencv2/opencv.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Per-frame preprocessing shared by every model that runs on the frame.
+//
+// Each registered model input size is a level. Levels are ordered from the
+// largest to the smallest. A level is scaled from the nearest larger level
+// already built in the frame, or else straight from the frame, so a frame
+// only ever pays for the levels that are asked for. Colour conversion is done
+// after scaling from the frame, since swapping channels commutes with
+// scaling.
+//
+// Levels are built on first use in a frame and handed out as views, so
+// another model on the same frame usually costs one small resize or
+// nothing at all.
+class FramePyramid {
+  public:
+    // A level handed out by get(). Its buffer isn't overwritten for a later
+    // frame while any copy of the view is alive, so keep the view, not just
+    // the image, for as long as the image is used.
+    class View {
+      public:
+        const cv::Mat &image() const { return mImage; }
+        bool empty() const { return mImage.empty(); }
+
+      private:
+        friend class FramePyramid;
+
+        cv::Mat mImage;
+        std::shared_ptr<void> mHold; // Counted in the level's users.
+    };
+
+    // Sizes can be registered up front or on the first get().
+    void addSize(cv::Size size);
+    // Starts a new 8 bit BGR frame, as returned by OpenCV. The frame is
+    // referenced, not copied.
+    void setFrame(const cv::Mat &bgr);
+    // RGB view of the current frame at the given size.
+    //
+    // Views stay valid after the next setFrame(): a level that is still
+    // viewed gets a new buffer instead of being overwritten.
+    View get(cv::Size size);
+
+    // Resizes done since the pyramid was created.
+    size_t resizes() const { return mResizes; }
+
+  private:
+    struct Level {
+        cv::Size size;
+        cv::Mat image;
+        // Views of the image still alive, from any thread.
+        std::shared_ptr<std::atomic<int>> users =
+            std::make_shared<std::atomic<int>>(0);
+        bool built = false;
+    };
+
+    const Level &build(size_t level);
+
+    cv::Mat mFrame;
+    cv::Mat mScaled; // BGR scratch for levels scaled from the frame.
+    std::vector<Level> mLevels; // Largest first.
+    size_t mResizes = 0;
+};
@@ -0,0 +1,253 @@
+#include "FrameRecorder.h"
+#include "bmp.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+// Header in front of every record in the raw container.
+struct RawRecordHeader {
+    uint32_t magic = 0x52555A49; // "IZUR"
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t channels = 0; // 0 for opaque bytes.
+    uint32_t bgr = 0;
+    uint32_t tagSize = 0;
+    uint64_t sequence = 0;
+    uint64_t timeNs = 0; // steady_clock time of the record() call.
+    uint64_t dataSize = 0;
+};
+
+} // namespace
+
+FrameRecorder::FrameRecorder(const Config &config)
+    : mConfig(config), mSlots(max<size_t>(config.slots, 1))
+{
+    if (mConfig.format == Format::Raw) {
+        string path = mConfig.directory + "/" + mConfig.prefix + ".raw";
+        mRawFile.open(path, ios::binary | ios::app);
+        if (!mRawFile)
+            errExit("Couldn't open " + path + " for recording.");
+    }
+    mWriter = thread(&FrameRecorder::writerLoop, this);
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCond.notify_all();
+    mWriter.join();
+}
+
+FrameRecorder::Slot *FrameRecorder::claim()
+{
+    lock_guard<mutex> lock(mMutex);
+    if (mCalls++ % max<size_t>(mConfig.everyNth, 1) != 0)
+        return nullptr;
+
+    // Prefer a free slot, else in LastSeconds mode the oldest retained one.
+    Slot *victim = nullptr;
+    for (auto &slot : mSlots) {
+        if (slot.state == State::Free) {
+            victim = &slot;
+            break;
+        }
+        if (mConfig.mode == Mode::LastSeconds &&
+            slot.state == State::Retained &&
+            (!victim || slot.sequence < victim->sequence))
+            victim = &slot;
+    }
+    if (!victim) {
+        ++mDropped;
+        return nullptr;
+    }
+
+    victim->state = State::Filling;
+    victim->sequence = mSequence++;
+    victim->time = chrono::steady_clock::now();
+    return victim;
+}
+
+void FrameRecorder::commit(Slot &slot)
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        slot.state = mConfig.mode == Mode::EveryNth ? State::Queued
+                                                    : State::Retained;
+    }
+    ++mRecorded;
+    if (mConfig.mode == Mode::EveryNth)
+        mCond.notify_one();
+}
+
+bool FrameRecorder::record(const uint8_t *data, int width, int height,
+                           int channels, const string &tag, bool bgr)
+{
+    Slot *slot = claim();
+    if (!slot)
+        return false;
+
+    // The slot's buffer keeps its capacity, so this is a plain copy after the
+    // first few frames.
+    slot->data.assign(data, data + size_t(width) * height * channels);
+    slot->width = width;
+    slot->height = height;
+    slot->channels = channels;
+    slot->bgr = bgr;
+    slot->tag = tag;
+    commit(*slot);
+    return true;
+}
+
+bool FrameRecorder::record(const cv::Mat &frame, const string &tag)
+{
+    Slot *slot = claim();
+    if (!slot)
+        return false;
+
+    size_t rowBytes = frame.cols * frame.elemSize();
+    slot->data.resize(rowBytes * frame.rows);
+    for (int row = 0; row < frame.rows; ++row)
+        memcpy(slot->data.data() + row * rowBytes, frame.ptr<uint8_t>(row),
+               rowBytes);
+    slot->width = frame.cols;
+    slot->height = frame.rows;
+    slot->channels = frame.channels();
+    slot->bgr = true;
+    slot->tag = tag;
+    commit(*slot);
+    return true;
+}
+
+bool FrameRecorder::recordBytes(const void *data, size_t bytes,
+                                const string &tag)
+{
+    Slot *slot = claim();
+    if (!slot)
+        return false;
+
+    const uint8_t *begin = static_cast<const uint8_t *>(data);
+    slot->data.assign(begin, begin + bytes);
+    slot->width = slot->height = slot->channels = 0;
+    slot->bgr = false;
+    slot->tag = tag;
+    commit(*slot);
+    return true;
+}
+
+void FrameRecorder::dump()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        auto oldest = chrono::steady_clock::now() -
+                      chrono::duration_cast<chrono::steady_clock::duration>(
+                          chrono::duration<double>(mConfig.keepSeconds));
+        for (auto &slot : mSlots) {
+            if (slot.state != State::Retained)
+                continue;
+            slot.state = slot.time >= oldest ? State::Queued : State::Free;
+        }
+    }
+    mCond.notify_one();
+}
+
+void FrameRecorder::writerLoop()
+{
+    while (true) {
+        Slot *next = nullptr;
+        {
+            unique_lock<mutex> lock(mMutex);
+            auto findQueued = [this, &next] {
+                next = nullptr;
+                for (auto &slot : mSlots)
+                    if (slot.state == State::Queued &&
+                        (!next || slot.sequence < next->sequence))
+                        next = &slot;
+                return next != nullptr;
+            };
+            mCond.wait(lock, [&] { return findQueued() || mStop; });
+            if (!next)
+                return;
+            next->state = State::Writing;
+        }
+
+        write(*next);
+        ++mWritten;
+
+        lock_guard<mutex> lock(mMutex);
+        next->state = State::Free;
+    }
+}
+
+void FrameRecorder::write(const Slot &slot)
+{
+    if (mConfig.format == Format::Raw) {
+        RawRecordHeader header;
+        header.width = slot.width;
+        header.height = slot.height;
+        header.channels = slot.channels;
+        header.bgr = slot.bgr;
+        header.tagSize = slot.tag.size();
+        header.sequence = slot.sequence;
+        header.timeNs = chrono::duration_cast<chrono::nanoseconds>(
+                            slot.time.time_since_epoch())
+                            .count();
+        header.dataSize = slot.data.size();
+        mRawFile.write(reinterpret_cast<const char *>(&header),
+                       sizeof(header));
+        mRawFile.write(slot.tag.data(), slot.tag.size());
+        mRawFile.write(reinterpret_cast<const char *>(slot.data.data()),
+                       slot.data.size());
+        mRawFile.flush();
+        return;
+    }
+
+    ostringstream name;
+    name << mConfig.directory << "/" << mConfig.prefix << "_" << setw(8)
+         << setfill('0') << slot.sequence << "_" << slot.tag;
+
+    if (slot.channels != 3 && slot.channels != 4) {
+        ofstream file(name.str() + ".bin", ios::binary);
+        file.write(reinterpret_cast<const char *>(slot.data.data()),
+                   slot.data.size());
+        return;
+    }
+
+    string file = name.str() + ".bmp";
+    // writeBmp takes 3 channels as RGB and 4 channels as BGRA.
+    if (slot.bgr && slot.channels == 3) {
+        size_t pixels = size_t(slot.width) * slot.height;
+        mScratch.resize(pixels * 4);
+        for (size_t i = 0; i < pixels; ++i) {
+            mScratch[4 * i] = slot.data[3 * i];
+            mScratch[4 * i + 1] = slot.data[3 * i + 1];
+            mScratch[4 * i + 2] = slot.data[3 * i + 2];
+            mScratch[4 * i + 3] = 255;
+        }
+        writeBmp(slot.width, slot.height, 4, mScratch, file.c_str());
+    }
+    else if (!slot.bgr && slot.channels == 4) {
+        size_t pixels = size_t(slot.width) * slot.height;
+        mScratch.resize(pixels * 4);
+        for (size_t i = 0; i < pixels; ++i) {
+            mScratch[4 * i] = slot.data[4 * i + 2];
+            mScratch[4 * i + 1] = slot.data[4 * i + 1];
+            mScratch[4 * i + 2] = slot.data[4 * i];
+            mScratch[4 * i + 3] = slot.data[4 * i + 3];
+        }
+        writeBmp(slot.width, slot.height, 4, mScratch, file.c_str());
+    }
+    else {
+        writeBmp(slot.width, slot.height, slot.channels, slot.data,
+                 file.c_str());
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "opencv2/opencv.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records frames, input tensors or raw outputs to disk on a background
+// thread, so debug captures never block the inference path.
+//
+// Data is copied into a bounded ring of preallocated slots. When the writer
+// can't keep up and every slot is busy, new data is dropped instead of
+// stalling the caller.
+//
+// In EveryNth mode every Nth record() call is queued for writing right away.
+// In LastSeconds mode the ring keeps overwriting the oldest data and nothing
+// is written until dump() is called, which writes what was recorded in the
+// last keepSeconds.
+class FrameRecorder {
+  public:
+    enum class Format {
+        Bmp, // One BMP file per image, one .bin file per raw record.
+        Raw  // Everything appended to a single <prefix>.raw file.
+    };
+    enum class Mode { EveryNth, LastSeconds };
+
+    struct Config {
+        std::string directory = ".";
+        std::string prefix = "frame";
+        Format format = Format::Bmp;
+        Mode mode = Mode::EveryNth;
+        size_t slots = 8;
+        size_t everyNth = 1;
+        double keepSeconds = 10.0;
+    };
+
+    FrameRecorder(const Config &config);
+    // Writes everything still queued before returning.
+    ~FrameRecorder();
+
+    // Records an 8 bit RGB(A) image, or BGR(A) when bgr is set. Returns false
+    // if the data was skipped or dropped.
+    bool record(const uint8_t *data, int width, int height, int channels,
+                const std::string &tag, bool bgr = false);
+    // Records a BGR OpenCV frame.
+    bool record(const cv::Mat &frame, const std::string &tag);
+    // Records opaque bytes such as output tensors.
+    bool recordBytes(const void *data, size_t bytes, const std::string &tag);
+
+    // LastSeconds mode: writes out the retained window.
+    void dump();
+
+    uint64_t recorded() const { return mRecorded; }
+    uint64_t dropped() const { return mDropped; }
+    uint64_t written() const { return mWritten; }
+
+  private:
+    enum class State { Free, Filling, Retained, Queued, Writing };
+
+    struct Slot {
+        State state = State::Free;
+        std::vector<uint8_t> data;
+        int width = 0;
+        int height = 0;
+        int channels = 0; // 0 for raw bytes.
+        bool bgr = false;
+        std::string tag;
+        uint64_t sequence = 0;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    // Claims a slot for the next record, or returns nullptr to drop it.
+    Slot *claim();
+    void commit(Slot &slot);
+    void writerLoop();
+    void write(const Slot &slot);
+
+    const Config mConfig;
+    std::vector<Slot> mSlots;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::thread mWriter;
+    bool mStop = false;
+    uint64_t mCalls = 0;
+    uint64_t mSequence = 0;
+    std::ofstream mRawFile;
+    std::vector<uint8_t> mScratch; // Writer side BGR/RGB conversion buffer.
+
+    std::atomic<uint64_t> mRecorded{0};
+    std::atomic<uint64_t> mDropped{0};
+    std::atomic<uint64_t> mWritten{0};
+};
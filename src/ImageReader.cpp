@@ -0,0 +1,236 @@
+#include "ImageReader.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef IO_URING
+#include <liburing.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+size_t roundUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+ImageReader::ImageReader(const vector<string> &files, const Config &config)
+    : mFiles(files), mConfig(config), mBuffers(max<size_t>(config.depth, 1))
+{
+    for (size_t i = 0; i < mBuffers.size(); ++i)
+        mFree.push_back(i);
+
+#ifdef IO_URING
+    mRing = make_unique<io_uring>();
+    int ret = io_uring_queue_init(mBuffers.size(), mRing.get(), 0);
+    if (ret == 0) {
+        mThreads.emplace_back(&ImageReader::uringLoop, this);
+        return;
+    }
+    mRing.reset();
+    cerr << "[WARNING]: io_uring is unavailable (" << strerror(-ret)
+         << "), reading with threads.\n";
+#endif
+    for (size_t i = 0; i < mBuffers.size(); ++i)
+        mThreads.emplace_back(&ImageReader::workerLoop, this);
+}
+
+ImageReader::~ImageReader()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStop = true;
+    }
+    mFreeCond.notify_all();
+    for (auto &t : mThreads)
+        t.join();
+#ifdef IO_URING
+    if (mRing)
+        io_uring_queue_exit(mRing.get());
+#endif
+    for (auto &buffer : mBuffers)
+        free(buffer.data);
+}
+
+bool ImageReader::next(File &file)
+{
+    unique_lock<mutex> lock(mMutex);
+    mReadCond.wait(lock, [this] {
+        return !mRead.empty() || mHandedOut == mFiles.size();
+    });
+    if (mRead.empty())
+        return false;
+    file = mRead.front();
+    mRead.pop_front();
+    ++mHandedOut;
+    return true;
+}
+
+void ImageReader::release(const File &file)
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mFree.push_back(file.buffer);
+    }
+    mFreeCond.notify_one();
+}
+
+bool ImageReader::start(bool wait, size_t &index, size_t &buffer, int &fd,
+                        size_t &size)
+{
+    {
+        unique_lock<mutex> lock(mMutex);
+        auto ready = [this] {
+            return mStop || mStarted == mFiles.size() || !mFree.empty();
+        };
+        if (wait)
+            mFreeCond.wait(lock, ready);
+        if (mStop || mStarted == mFiles.size() || mFree.empty())
+            return false;
+        index = mStarted++;
+        buffer = mFree.back();
+        mFree.pop_back();
+    }
+
+    fd = openFile(mFiles[index]);
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        errExit("Unable to stat " + mFiles[index]);
+    size = static_cast<size_t>(st.st_size);
+    grow(mBuffers[buffer], size);
+    return true;
+}
+
+void ImageReader::finish(size_t index, size_t buffer, int fd, size_t size)
+{
+    close(fd);
+    {
+        lock_guard<mutex> lock(mMutex);
+        mRead.push_back({index, mBuffers[buffer].data, size, buffer});
+    }
+    mReadCond.notify_one();
+}
+
+int ImageReader::openFile(const string &path)
+{
+    int fd = -1;
+    if (mConfig.direct)
+        fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0)
+        fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        errExit("Unable to open " + path);
+    return fd;
+}
+
+void ImageReader::grow(Buffer &buffer, size_t size)
+{
+    // Whole aligned blocks, so direct reads can ask for the full capacity.
+    size_t capacity = roundUp(max<size_t>(size, 1), ALIGNMENT);
+    if (buffer.capacity >= capacity)
+        return;
+
+    free(buffer.data);
+    void *data = nullptr;
+    if (posix_memalign(&data, ALIGNMENT, capacity) != 0)
+        errExit("Couldn't allocate " + to_string(capacity) + " bytes.");
+    buffer.data = static_cast<uint8_t *>(data);
+    buffer.capacity = capacity;
+}
+
+void ImageReader::workerLoop()
+{
+    size_t index, buffer, size;
+    int fd;
+    while (start(true, index, buffer, fd, size)) {
+        const Buffer &b = mBuffers[buffer];
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = pread(fd, b.data + done, b.capacity - done, done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                errExit("Couldn't read " + mFiles[index]);
+            if (n == 0)
+                break; // Truncated since it was opened.
+            done += n;
+        }
+        finish(index, buffer, fd, min(done, size));
+    }
+}
+
+#ifdef IO_URING
+void ImageReader::uringLoop()
+{
+    struct Read {
+        size_t index;
+        size_t buffer;
+        int fd;
+        size_t size;
+        size_t done;
+    };
+    // One read per buffer at most, so the buffer identifies it.
+    vector<Read> reads(mBuffers.size());
+    auto submit = [this](Read &read) {
+        const Buffer &b = mBuffers[read.buffer];
+        io_uring_sqe *sqe = io_uring_get_sqe(mRing.get());
+        io_uring_prep_read(sqe, read.fd, b.data + read.done,
+                           b.capacity - read.done, read.done);
+        io_uring_sqe_set_data(sqe, &read);
+    };
+
+    size_t inFlight = 0;
+    while (true) {
+        // Only block for a free buffer when no completion is coming.
+        Read read;
+        while (inFlight < mBuffers.size() &&
+               start(inFlight == 0, read.index, read.buffer, read.fd,
+                     read.size)) {
+            read.done = 0;
+            reads[read.buffer] = read;
+            submit(reads[read.buffer]);
+            ++inFlight;
+        }
+        if (inFlight == 0)
+            return;
+
+        io_uring_submit(mRing.get());
+        io_uring_cqe *cqe;
+        int ret = io_uring_wait_cqe(mRing.get(), &cqe);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            errExit("Waiting for io_uring failed: " + string(strerror(-ret)));
+
+        Read &done = *static_cast<Read *>(io_uring_cqe_get_data(cqe));
+        int res = cqe->res;
+        io_uring_cqe_seen(mRing.get(), cqe);
+        if (res == -EINTR || res == -EAGAIN) {
+            submit(done);
+            continue;
+        }
+        if (res < 0)
+            errExit("Couldn't read " + mFiles[done.index] + ": " +
+                    strerror(-res));
+
+        done.done += res;
+        if (res > 0 && done.done < done.size) {
+            submit(done); // Short read, continue where it stopped.
+            continue;
+        }
+        --inFlight;
+        finish(done.index, done.buffer, done.fd, min(done.done, done.size));
+    }
+}
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef IO_URING
+struct io_uring;
+#endif
+
+// Reads a list of files with many reads in flight, so a fast disk stays busy
+// while earlier files are decoded and inferred.
+//
+// Files are read whole into a fixed pool of aligned buffers and handed out in
+// completion order. A buffer is only reused once it is released, which bounds
+// memory and makes reading wait for a consumer that falls behind.
+//
+// Built with IO_URING, one thread keeps up to depth reads queued on an
+// io_uring. Otherwise, or if the kernel doesn't allow io_uring, depth
+// threads each do blocking reads.
+class ImageReader {
+  public:
+    struct Config {
+        size_t depth = 16; // Reads in flight, and buffers in the pool.
+        // Bypasses the page cache, for data sets larger than memory. Falls
+        // back to cached reads where the file system doesn't support it.
+        bool direct = false;
+    };
+
+    struct File {
+        size_t index = 0; // Position in the list of files.
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        size_t buffer = 0;
+    };
+
+    ImageReader(const std::vector<std::string> &files, const Config &config);
+    ~ImageReader();
+
+    // Blocks until another file is read. Returns false once every file has
+    // been handed out. Files that can't be read are fatal.
+    bool next(File &file);
+    // Returns the file's buffer to the pool. Any thread may call this.
+    void release(const File &file);
+
+  private:
+    constexpr static size_t ALIGNMENT = 4096; // Enough for O_DIRECT.
+
+    struct Buffer {
+        uint8_t *data = nullptr;
+        size_t capacity = 0;
+    };
+
+    // Opens the next file and sizes a free buffer for it. Returns false when
+    // every file has been started, or without wait when no buffer is free.
+    bool start(bool wait, size_t &index, size_t &buffer, int &fd,
+               size_t &size);
+    void finish(size_t index, size_t buffer, int fd, size_t size);
+    int openFile(const std::string &path);
+    void grow(Buffer &buffer, size_t size);
+    void workerLoop();
+#ifdef IO_URING
+    void uringLoop();
+#endif
+
+    const std::vector<std::string> mFiles;
+    const Config mConfig;
+    std::vector<Buffer> mBuffers;
+#ifdef IO_URING
+    std::unique_ptr<io_uring> mRing;
+#endif
+
+    std::mutex mMutex;
+    std::condition_variable mFreeCond;
+    std::condition_variable mReadCond;
+    std::vector<size_t> mFree;
+    std::deque<File> mRead;
+    size_t mStarted = 0;
+    size_t mHandedOut = 0;
+    bool mStop = false;
+    std::vector<std::thread> mThreads;
+};
@@ -0,0 +1,66 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+MappedFile::MappedFile() {}
+
+MappedFile::MappedFile(const char *file) { open(file); }
+
+MappedFile::MappedFile(MappedFile &&other) { *this = std::move(other); }
+
+MappedFile &MappedFile::operator=(MappedFile &&other)
+{
+    if (this != &other) {
+        close();
+        std::swap(mData, other.mData);
+        std::swap(mSize, other.mSize);
+        std::swap(mOpen, other.mOpen);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::open(const char *file)
+{
+    close();
+
+    int fd = ::open(file, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    mSize = static_cast<size_t>(st.st_size);
+    if (mSize > 0) {
+        void *ptr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            ::close(fd);
+            mSize = 0;
+            return false;
+        }
+        mData = static_cast<const uint8_t *>(ptr);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    mOpen = true;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mData)
+        munmap(const_cast<uint8_t *>(mData), mSize);
+    mData = nullptr;
+    mSize = 0;
+    mOpen = false;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+  public:
+    MappedFile();
+    MappedFile(const char *file);
+    MappedFile(MappedFile &&other);
+    MappedFile &operator=(MappedFile &&other);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    // Returns false if the file can't be opened or mapped.
+    bool open(const char *file);
+    void close();
+
+    bool isOpen() const { return mOpen; }
+    const uint8_t *data() const { return mData; }
+    size_t size() const { return mSize; }
+
+  private:
+    const uint8_t *mData = nullptr;
+    size_t mSize = 0;
+    bool mOpen = false;
+};
@@ -0,0 +1,341 @@
+#include "Metrics.h"
+#include "utils.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+// Resident set size from /proc/self/statm, which counts pages.
+double residentBytes()
+{
+    ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return double(resident) * sysconf(_SC_PAGESIZE);
+}
+
+string withLabels(const string &name, const string &labels,
+                  const string &extra = "")
+{
+    if (labels.empty() && extra.empty())
+        return name;
+    string all = labels;
+    if (!labels.empty() && !extra.empty())
+        all += ",";
+    return name + "{" + all + extra + "}";
+}
+
+const char *typeName(int type)
+{
+    static const char *names[] = {"counter", "gauge", "histogram"};
+    return names[type];
+}
+
+} // namespace
+
+void Gauge::add(double delta)
+{
+    double value = mValue.load(memory_order_relaxed);
+    while (!mValue.compare_exchange_weak(value, value + delta,
+                                         memory_order_relaxed))
+        ;
+}
+
+Histogram::Histogram(vector<double> bounds)
+    : mBounds(move(bounds)),
+      mBuckets(new atomic<uint64_t>[mBounds.size() + 1])
+{
+    for (size_t i = 0; i <= mBounds.size(); ++i)
+        mBuckets[i] = 0;
+}
+
+void Histogram::observe(double value)
+{
+    size_t i = lower_bound(mBounds.begin(), mBounds.end(), value) -
+               mBounds.begin();
+    mBuckets[i].fetch_add(1, memory_order_relaxed);
+    mCount.fetch_add(1, memory_order_relaxed);
+    mSum.add(value);
+}
+
+vector<double> latencyBuckets()
+{
+    return {0.001, 0.0025, 0.005, 0.01,  0.02, 0.035, 0.05,
+            0.075, 0.1,    0.15,  0.25,  0.5,  1.0,   2.5};
+}
+
+MetricsRegistry::Metric *MetricsRegistry::find(const string &name,
+                                               const string &labels,
+                                               Type type)
+{
+    for (auto &m : mMetrics) {
+        if (m->name != name || m->labels != labels)
+            continue;
+        if (m->type != type)
+            errExit("Metric " + name + " registered with another type.");
+        return m.get();
+    }
+    return nullptr;
+}
+
+MetricsRegistry::Metric &MetricsRegistry::add(const string &name,
+                                              const string &help,
+                                              const string &labels, Type type)
+{
+    auto metric = make_unique<Metric>();
+    metric->name = name;
+    metric->help = help;
+    metric->labels = labels;
+    metric->type = type;
+    mMetrics.push_back(move(metric));
+    return *mMetrics.back();
+}
+
+Counter &MetricsRegistry::counter(const string &name, const string &help,
+                                  const string &labels)
+{
+    lock_guard<mutex> lock(mMutex);
+    if (Metric *m = find(name, labels, Type::Counter))
+        return *m->counter;
+    Metric &m = add(name, help, labels, Type::Counter);
+    m.counter = make_unique<Counter>();
+    return *m.counter;
+}
+
+Gauge &MetricsRegistry::gauge(const string &name, const string &help,
+                              const string &labels)
+{
+    lock_guard<mutex> lock(mMutex);
+    if (Metric *m = find(name, labels, Type::Gauge)) {
+        if (!m->gauge)
+            errExit("Metric " + name + " is computed, it can't be set.");
+        return *m->gauge;
+    }
+    Metric &m = add(name, help, labels, Type::Gauge);
+    m.gauge = make_unique<Gauge>();
+    return *m.gauge;
+}
+
+Histogram &MetricsRegistry::histogram(const string &name, const string &help,
+                                      const string &labels,
+                                      vector<double> bounds)
+{
+    lock_guard<mutex> lock(mMutex);
+    if (Metric *m = find(name, labels, Type::Histogram))
+        return *m->histogram;
+    Metric &m = add(name, help, labels, Type::Histogram);
+    m.histogram = make_unique<Histogram>(move(bounds));
+    return *m.histogram;
+}
+
+void MetricsRegistry::gaugeFunction(const string &name, const string &help,
+                                    function<double()> value,
+                                    const string &labels)
+{
+    lock_guard<mutex> lock(mMutex);
+    Metric *m = find(name, labels, Type::Gauge);
+    if (!m)
+        m = &add(name, help, labels, Type::Gauge);
+    m->gauge.reset();
+    m->function = move(value);
+}
+
+string MetricsRegistry::render() const
+{
+    lock_guard<mutex> lock(mMutex);
+
+    // Samples of one metric have to be grouped under its HELP and TYPE.
+    vector<const Metric *> sorted;
+    for (const auto &m : mMetrics)
+        sorted.push_back(m.get());
+    stable_sort(sorted.begin(), sorted.end(),
+                [](const Metric *a, const Metric *b) {
+                    return a->name < b->name;
+                });
+
+    ostringstream out;
+    out.precision(10);
+    const string *previous = nullptr;
+    for (const Metric *m : sorted) {
+        if (!previous || *previous != m->name) {
+            out << "# HELP " << m->name << " " << m->help << "\n";
+            out << "# TYPE " << m->name << " "
+                << typeName(static_cast<int>(m->type)) << "\n";
+            previous = &m->name;
+        }
+
+        switch (m->type) {
+        case Type::Counter:
+            out << withLabels(m->name, m->labels) << " "
+                << m->counter->value() << "\n";
+            break;
+        case Type::Gauge:
+            out << withLabels(m->name, m->labels) << " "
+                << (m->function ? m->function() : m->gauge->value()) << "\n";
+            break;
+        case Type::Histogram: {
+            const Histogram &h = *m->histogram;
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i <= h.bounds().size(); ++i) {
+                cumulative += h.bucket(i);
+                ostringstream le;
+                le.precision(10);
+                le << "le=\"";
+                if (i < h.bounds().size())
+                    le << h.bounds()[i];
+                else
+                    le << "+Inf";
+                le << "\"";
+                out << withLabels(m->name + "_bucket", m->labels, le.str())
+                    << " " << cumulative << "\n";
+            }
+            out << withLabels(m->name + "_sum", m->labels) << " " << h.sum()
+                << "\n";
+            out << withLabels(m->name + "_count", m->labels) << " "
+                << cumulative << "\n";
+            break;
+        }
+        }
+    }
+
+    out << "# HELP process_resident_memory_bytes Resident memory size.\n";
+    out << "# TYPE process_resident_memory_bytes gauge\n";
+    out << "process_resident_memory_bytes " << residentBytes() << "\n";
+    return out.str();
+}
+
+function<double()> utilisationOf(const Histogram &durations, double capacity)
+{
+    auto lastTime = chrono::steady_clock::now();
+    double lastSum = durations.sum();
+    return [&durations, capacity, lastTime, lastSum]() mutable {
+        auto now = chrono::steady_clock::now();
+        double sum = durations.sum();
+        chrono::duration<double> elapsed = now - lastTime;
+        double busy = sum - lastSum;
+        lastTime = now;
+        lastSum = sum;
+        if (elapsed.count() <= 0.0 || capacity <= 0.0)
+            return 0.0;
+        return busy / elapsed.count() / capacity;
+    };
+}
+
+MetricsServer::MetricsServer(const MetricsRegistry &registry,
+                             const string &address)
+    : mRegistry(registry)
+{
+    if (address.rfind("unix:", 0) == 0) {
+        mUnixPath = address.substr(5);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (mUnixPath.size() >= sizeof(addr.sun_path))
+            errExit("Unix socket path too long: " + mUnixPath);
+        strcpy(addr.sun_path, mUnixPath.c_str());
+        unlink(mUnixPath.c_str());
+
+        mSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (mSocket < 0 ||
+            bind(mSocket, reinterpret_cast<sockaddr *>(&addr),
+                 sizeof(addr)) != 0)
+            errExit("Couldn't bind metrics socket " + mUnixPath);
+    }
+    else {
+        size_t colon = address.rfind(':');
+        string host =
+            colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+        int port = stoi(colon == string::npos ? address
+                                              : address.substr(colon + 1));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+            errExit("Invalid metrics address " + address);
+
+        mSocket = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        if (mSocket < 0 ||
+            setsockopt(mSocket, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                       sizeof(reuse)) != 0 ||
+            bind(mSocket, reinterpret_cast<sockaddr *>(&addr),
+                 sizeof(addr)) != 0)
+            errExit("Couldn't bind metrics port " + address);
+    }
+
+    if (listen(mSocket, 8) != 0)
+        errExit("Couldn't listen on " + address);
+    cout << "Serving metrics on " << address << "\n";
+    mThread = thread(&MetricsServer::serveLoop, this);
+}
+
+MetricsServer::~MetricsServer()
+{
+    mStop = true;
+    mThread.join();
+    close(mSocket);
+    if (!mUnixPath.empty())
+        unlink(mUnixPath.c_str());
+}
+
+void MetricsServer::serveLoop()
+{
+    while (!mStop) {
+        // Wake up regularly to notice mStop.
+        pollfd fd = {mSocket, POLLIN, 0};
+        if (poll(&fd, 1, 200) <= 0)
+            continue;
+        int client = accept(mSocket, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        respond(client);
+        close(client);
+    }
+}
+
+void MetricsServer::respond(int client)
+{
+    // Every request gets the metrics, whatever its path. Read the request
+    // headers so the client doesn't see a reset.
+    char request[1024];
+    string header;
+    pollfd fd = {client, POLLIN, 0};
+    while (header.find("\r\n\r\n") == string::npos && poll(&fd, 1, 100) > 0) {
+        ssize_t n = read(client, request, sizeof(request));
+        if (n <= 0)
+            break;
+        header.append(request, n);
+        if (header.size() > 16 * 1024)
+            break;
+    }
+
+    string body = mRegistry.render();
+    string response = "HTTP/1.1 200 OK\r\n"
+                      "Content-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: " +
+                      to_string(body.size()) +
+                      "\r\n"
+                      "Connection: close\r\n\r\n" +
+                      body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(client, response.data() + sent,
+                         response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Monotonic count. Updated with relaxed atomics, so it is safe and cheap to
+// bump from any thread.
+class Counter {
+  public:
+    void inc(uint64_t n = 1) { mValue.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return mValue.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> mValue{0};
+};
+
+class Gauge {
+  public:
+    void set(double value) { mValue.store(value, std::memory_order_relaxed); }
+    void add(double delta);
+    double value() const { return mValue.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<double> mValue{0.0};
+};
+
+// Counts observations into fixed buckets. Quantiles are estimated from the
+// buckets by whoever scrapes them.
+class Histogram {
+  public:
+    // Upper bounds in ascending order; a +Inf bucket is added.
+    Histogram(std::vector<double> bounds);
+
+    void observe(double value);
+
+    const std::vector<double> &bounds() const { return mBounds; }
+    // Non-cumulative count of bucket i, bounds().size() being +Inf.
+    uint64_t bucket(size_t i) const
+    {
+        return mBuckets[i].load(std::memory_order_relaxed);
+    }
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+    double sum() const { return mSum.value(); }
+
+  private:
+    const std::vector<double> mBounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> mBuckets;
+    std::atomic<uint64_t> mCount{0};
+    Gauge mSum;
+};
+
+// Bounds in seconds for latencies from 1 ms to 2.5 s.
+std::vector<double> latencyBuckets();
+
+// Named metrics rendered in the Prometheus text format.
+//
+// Looking a metric up takes a lock, so components keep the returned
+// references and only touch the atomics on their hot paths.
+class MetricsRegistry {
+  public:
+    // The metric with this name and labels, created on first use. Labels are
+    // Prometheus label pairs such as stream="0".
+    Counter &counter(const std::string &name, const std::string &help,
+                     const std::string &labels = "");
+    Gauge &gauge(const std::string &name, const std::string &help,
+                 const std::string &labels = "");
+    Histogram &histogram(const std::string &name, const std::string &help,
+                         const std::string &labels = "",
+                         std::vector<double> bounds = latencyBuckets());
+    // A gauge whose value is computed when scraped.
+    void gaugeFunction(const std::string &name, const std::string &help,
+                       std::function<double()> value,
+                       const std::string &labels = "");
+
+    // All metrics plus the process' resident memory.
+    std::string render() const;
+
+  private:
+    enum class Type { Counter, Gauge, Histogram };
+
+    struct Metric {
+        std::string name;
+        std::string help;
+        std::string labels;
+        Type type;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+        std::function<double()> function;
+    };
+
+    // Must hold mMutex.
+    Metric *find(const std::string &name, const std::string &labels,
+                 Type type);
+    Metric &add(const std::string &name, const std::string &help,
+                const std::string &labels, Type type);
+
+    mutable std::mutex mMutex;
+    std::vector<std::unique_ptr<Metric>> mMetrics;
+};
+
+// Fraction of wall time covered by the durations observed since the previous
+// call, divided by capacity (e.g. the number of interpreters). Meant for
+// gaugeFunction().
+std::function<double()> utilisationOf(const Histogram &durations,
+                                      double capacity);
+
+// Serves a registry to Prometheus over HTTP on a background thread. The
+// address is "host:port" or "unix:/path/to/socket".
+class MetricsServer {
+  public:
+    MetricsServer(const MetricsRegistry &registry, const std::string &address);
+    ~MetricsServer();
+
+  private:
+    void serveLoop();
+    void respond(int client);
+
+    const MetricsRegistry &mRegistry;
+    std::string mUnixPath;
+    int mSocket = -1;
+    std::atomic<bool> mStop{false};
+    std::thread mThread;
+};
@@ -0,0 +1,123 @@
+#include "ModelLadder.h"
+#include "utils.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+void smooth(double &average, double sample, double weight)
+{
+    average = average == 0.0 ? sample : average + weight * (sample - average);
+}
+
+} // namespace
+
+ModelLadder::ModelLadder(const Config &config) : mConfig(config) {}
+
+void ModelLadder::addRung(const string &modelFile, ModelReloader::Setup setup)
+{
+    auto rung = make_unique<Rung>();
+    rung->model = make_unique<ModelReloader>(modelFile, move(setup));
+    mRungs.push_back(move(rung));
+}
+
+void ModelLadder::load()
+{
+    if (mRungs.empty())
+        errExit("The model ladder has no rungs.");
+    for (auto &rung : mRungs)
+        rung->model->load();
+}
+
+void ModelLadder::watch(int pollMs, const vector<int> &cpus)
+{
+    for (auto &rung : mRungs)
+        rung->model->watch(pollMs, cpus);
+}
+
+cv::Size ModelLadder::inputSize(size_t i) const
+{
+    vector<int> dims = mRungs[i]->model->current()->getInputDims();
+    if (dims.size() != 4)
+        errExit("Model ladder rungs need a [1, height, width, channels] "
+                "input.");
+    return cv::Size(dims[2], dims[1]);
+}
+
+double ModelLadder::estimateMs(size_t rung) const
+{
+    if (mRungs[rung]->inferenceMs > 0.0)
+        return mRungs[rung]->inferenceMs;
+
+    size_t from = current();
+    double fromMs = mRungs[from]->inferenceMs;
+    if (fromMs <= 0.0)
+        return 0.0;
+    return fromMs * inputSize(rung).area() / inputSize(from).area();
+}
+
+void ModelLadder::switchTo(size_t rung)
+{
+    mCurrent.store(rung, memory_order_relaxed);
+    ++mSwitches;
+    mSinceSwitch = 0;
+    mLastQueued = 0;
+    // Latency measured on the old rung says nothing about the new one.
+    mResultLatencyMs = 0.0;
+}
+
+size_t ModelLadder::choose(bool queued)
+{
+    lock_guard<mutex> lock(mMutex);
+
+    auto now = chrono::steady_clock::now();
+    if (mLastOffer != chrono::steady_clock::time_point()) {
+        chrono::duration<double, milli> interval = now - mLastOffer;
+        smooth(mOfferIntervalMs, interval.count(), SMOOTHING);
+    }
+    mLastOffer = now;
+
+    size_t rung = current();
+    if (queued)
+        mLastQueued = mSinceSwitch;
+    // Wait for results from the current rung before judging it.
+    if (mSinceSwitch < 2)
+        return rung;
+
+    bool overLatency = mConfig.targetLatencyMs > 0.0 &&
+                       mResultLatencyMs > mConfig.targetLatencyMs;
+    if ((queued || overLatency) && rung + 1 < mRungs.size()) {
+        switchTo(rung + 1);
+        return rung + 1;
+    }
+
+    // Hold until the rung has kept up for a while, also since switching.
+    if (rung == 0 || mSinceSwitch - mLastQueued < mConfig.holdInferences)
+        return rung;
+
+    // Climb if the better rung's extra cost fits in the headroom.
+    double better = estimateMs(rung - 1);
+    double extra = better - estimateMs(rung);
+    bool fits = mConfig.targetLatencyMs > 0.0
+                    ? mResultLatencyMs + extra <
+                          mConfig.climbMargin * mConfig.targetLatencyMs
+                    : better < mConfig.climbMargin * mOfferIntervalMs;
+    if (better > 0.0 && fits) {
+        switchTo(rung - 1);
+        return rung - 1;
+    }
+    return rung;
+}
+
+void ModelLadder::recordInference(size_t rung, double inferenceMs,
+                                  double resultLatencyMs)
+{
+    lock_guard<mutex> lock(mMutex);
+    smooth(mRungs[rung]->inferenceMs, inferenceMs, SMOOTHING);
+    if (rung != current())
+        return;
+    smooth(mResultLatencyMs, resultLatencyMs, SMOOTHING);
+    ++mSinceSwitch;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ModelReloader.h"
+
+#include "opencv2/opencv.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Variants of one model, e.g. at different input resolutions or widths,
+// ordered from the most accurate to the cheapest. The rung used for each
+// frame follows the load: under bursts it steps down to a cheaper variant
+// instead of letting frames queue up or get dropped, and it climbs back once
+// the better variant fits again.
+//
+// Every rung is a ModelReloader, so variants can be hot-swapped too.
+class ModelLadder {
+  public:
+    struct Config {
+        // Capture to result latency to stay under. With 0 the ladder only
+        // reacts to queueing and to the rate frames are offered at.
+        double targetLatencyMs = 0.0;
+        // Inferences on a rung, and since a frame last had to queue, before
+        // climbing from it again.
+        int holdInferences = 30;
+        // Climb when the better rung is estimated to need less than this
+        // fraction of the latency target or of the offer interval.
+        double climbMargin = 0.8;
+    };
+
+    ModelLadder(const Config &config);
+
+    // Rungs are added best first.
+    void addRung(const std::string &modelFile,
+                 ModelReloader::Setup setup = nullptr);
+    // Loads every rung on the calling thread.
+    void load();
+    // See ModelReloader::watch().
+    void watch(int pollMs = 500, const std::vector<int> &cpus = {});
+
+    size_t size() const { return mRungs.size(); }
+    ModelReloader &rung(size_t i) { return *mRungs[i]->model; }
+    // Width and height of the rung's current model input.
+    cv::Size inputSize(size_t i) const;
+
+    // Capture thread: the rung to preprocess and infer the next frame with.
+    // queued tells whether the previously offered frame is still waiting.
+    size_t choose(bool queued);
+    // Inference thread.
+    void recordInference(size_t rung, double inferenceMs,
+                         double resultLatencyMs);
+
+    size_t current() const { return mCurrent.load(std::memory_order_relaxed); }
+    uint64_t switches() const
+    {
+        return mSwitches.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Rung {
+        std::unique_ptr<ModelReloader> model;
+        double inferenceMs = 0.0; // EWMA, 0 until the rung has run.
+    };
+
+    // Estimated Invoke() time of a rung, scaled by input pixels from the
+    // current rung if it hasn't run yet. Must hold mMutex.
+    double estimateMs(size_t rung) const;
+    void switchTo(size_t rung);
+
+    const Config mConfig;
+    std::vector<std::unique_ptr<Rung>> mRungs;
+    std::atomic<size_t> mCurrent{0};
+    std::atomic<uint64_t> mSwitches{0};
+
+    std::mutex mMutex;
+    double mResultLatencyMs = 0.0;
+    double mOfferIntervalMs = 0.0;
+    std::chrono::steady_clock::time_point mLastOffer;
+    int mSinceSwitch = 0; // Inferences on the current rung.
+    int mLastQueued = 0;  // mSinceSwitch when a frame last found one queued.
+
+    constexpr static double SMOOTHING = 0.1; // EWMA weight of new samples.
+};
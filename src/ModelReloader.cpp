@@ -0,0 +1,134 @@
+#include "ModelReloader.h"
+#include "Topology.h"
+#include "utils.h"
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+ModelReloader::ModelReloader(string modelFile, Setup setup)
+    : mModelFile(move(modelFile)), mSetup(move(setup))
+{
+}
+
+ModelReloader::~ModelReloader()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCond.notify_all();
+    if (mWatcher.joinable())
+        mWatcher.join();
+}
+
+void ModelReloader::load()
+{
+    TIMER
+
+    fileState(&mLoaded);
+    shared_ptr<TfLite> model = build(false);
+    if (!model)
+        errExit("Couldn't build model from " + mModelFile);
+    atomic_store(&mModel, model);
+    ++mGeneration;
+}
+
+void ModelReloader::watch(int pollMs, vector<int> cpus)
+{
+    if (mWatcher.joinable())
+        return;
+    mCpus = move(cpus);
+    mWatcher = thread(&ModelReloader::watchLoop, this, pollMs);
+}
+
+bool ModelReloader::fileState(FileState *state) const
+{
+    struct stat st;
+    if (stat(mModelFile.c_str(), &st) != 0)
+        return false;
+    state->inode = st.st_ino;
+    state->size = st.st_size;
+    state->mtimeNs = int64_t(st.st_mtim.tv_sec) * 1000000000 +
+                     st.st_mtim.tv_nsec;
+    return true;
+}
+
+shared_ptr<TfLite> ModelReloader::build(bool background) const
+{
+    // Interpreter threads inherit the mask of the thread that builds and
+    // first invokes them, so reloads are made on the inference CPUs.
+    ScopedAffinity pin(background ? mCpus : vector<int>());
+
+    auto model = make_shared<TfLite>();
+    if (mSetup)
+        mSetup(*model);
+    if (background && model->getBackend() == TfLite::Backend::Gpu)
+        errExit("Reloading needs the CPU or XNNPACK backend, the GL delegate "
+                "can only run on the thread that created it.");
+    // Verified, so a broken file is rejected instead of taking the process
+    // down. The setup's memory node and page options apply to reloads too.
+    // Copied rather than mapped: the file may be rewritten in place while
+    // this model is still running.
+    if (!model->tryLoadModel(mModelFile.c_str(), true))
+        return nullptr;
+
+    // Warm up: the first Invoke() allocates and packs weights.
+    vector<uint8_t> zeros(model->getInputTensor()->bytes);
+    model->loadInput(zeros.data(), zeros.size());
+    model->invoke();
+    return model;
+}
+
+void ModelReloader::watchLoop(int pollMs)
+{
+    FileState pending;
+    bool changed = false;
+    // The replaced model, released here rather than on an inference thread
+    // once the last invocation using it is done.
+    shared_ptr<TfLite> retired;
+
+    unique_lock<mutex> lock(mMutex);
+    while (!mCond.wait_for(lock, chrono::milliseconds(pollMs),
+                           [this] { return mStop; })) {
+        // Nothing new can get a handle to it, so this can't race.
+        if (retired && retired.use_count() == 1)
+            retired.reset();
+
+        FileState state;
+        if (!fileState(&state) || state == mLoaded) {
+            changed = false;
+            continue;
+        }
+        // Only load once the file has stopped changing for a whole poll
+        // interval, so a model that is still being copied isn't picked up.
+        if (!changed || state != pending) {
+            pending = state;
+            changed = true;
+            continue;
+        }
+        changed = false;
+        mLoaded = state;
+
+        lock.unlock();
+        auto start = chrono::steady_clock::now();
+        shared_ptr<TfLite> model = build(true);
+        chrono::duration<double, milli> loadTime =
+            chrono::steady_clock::now() - start;
+        if (model) {
+            retired = atomic_exchange(&mModel, model);
+            ++mGeneration;
+            cout << "Reloaded " << mModelFile << " in " << loadTime.count()
+                 << " ms\n";
+        }
+        else {
+            cerr << "[WARNING]: " << mModelFile
+                 << " is not a valid model, keeping the current one.\n";
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "TfLite.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps a model current while its file is replaced, without stopping
+// inference.
+//
+// A watcher thread polls the model file. Once a change has settled, a new
+// TfLite is loaded, verified and warmed up with one invocation on that thread,
+// then swapped in atomically. Callers take a handle with current() for each
+// inference; invocations already running keep the old model alive until they
+// drop their handle. A model file that fails to verify is reported and the
+// previous model stays in use. Models are read into memory rather than
+// mapped, so the file may be rewritten in place, not only renamed over.
+class ModelReloader {
+  public:
+    // Configures each new TfLite (backend, threads, memory node, pages, ...)
+    // before its model is loaded, for the first load and every reload.
+    using Setup = std::function<void(TfLite &)>;
+
+    ModelReloader(std::string modelFile, Setup setup = nullptr);
+    ~ModelReloader();
+
+    // Loads the model on the calling thread and makes it current.
+    void load();
+    // Starts polling the model file every pollMs. Reloads happen on the
+    // watcher thread, so they can't use the GPU backend whose delegate is
+    // tied to the thread that created it. They are built and warmed up
+    // pinned to cpus, if any, so their interpreter threads run there.
+    void watch(int pollMs = 500, std::vector<int> cpus = {});
+    // Null until the first load.
+    std::shared_ptr<TfLite> current() const
+    {
+        return std::atomic_load(&mModel);
+    }
+    // Number of models loaded so far.
+    uint64_t generation() const { return mGeneration; }
+
+  private:
+    struct FileState {
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t mtimeNs = 0;
+        bool operator==(const FileState &o) const
+        {
+            return inode == o.inode && size == o.size && mtimeNs == o.mtimeNs;
+        }
+        bool operator!=(const FileState &o) const { return !(*this == o); }
+    };
+
+    bool fileState(FileState *state) const;
+    // Returns null if the file doesn't hold a valid model.
+    std::shared_ptr<TfLite> build(bool background) const;
+    void watchLoop(int pollMs);
+
+    const std::string mModelFile;
+    const Setup mSetup;
+    std::vector<int> mCpus; // Set before the watcher starts.
+    std::shared_ptr<TfLite> mModel;
+    std::atomic<uint64_t> mGeneration{0};
+    FileState mLoaded;
+
+    std::thread mWatcher;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    bool mStop = false;
+};
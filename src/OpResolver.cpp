@@ -0,0 +1,77 @@
+#include "OpResolver.h"
+
+#include "tensorflow/lite/kernels/register.h"
+
+#include <memory>
+
+#ifdef REDUCED_OPS
+// ReducedOps.inc lists the ops as IZU_BUILTIN_OP(name, minVersion,
+// maxVersion) and IZU_CUSTOM_OP(name, kernel, minVersion, maxVersion). It is
+// included once to declare the kernels' registration functions and once to
+// register them.
+#define IZU_BUILTIN_OP(name, minVersion, maxVersion)                           \
+    TfLiteRegistration *Register_##name();
+#define IZU_CUSTOM_OP(name, kernel, minVersion, maxVersion)
+
+namespace tflite {
+namespace ops {
+namespace builtin {
+#include "ReducedOps.inc"
+} // namespace builtin
+} // namespace ops
+} // namespace tflite
+
+#undef IZU_BUILTIN_OP
+#undef IZU_CUSTOM_OP
+#define IZU_BUILTIN_OP(name, minVersion, maxVersion)
+#define IZU_CUSTOM_OP(name, kernel, minVersion, maxVersion)                    \
+    TfLiteRegistration *Register_##kernel();
+
+namespace tflite {
+namespace ops {
+namespace custom {
+#include "ReducedOps.inc"
+} // namespace custom
+} // namespace ops
+} // namespace tflite
+
+#undef IZU_BUILTIN_OP
+#undef IZU_CUSTOM_OP
+
+namespace {
+
+std::unique_ptr<tflite::OpResolver> makeResolver()
+{
+    auto resolver = std::make_unique<tflite::MutableOpResolver>();
+
+#define IZU_BUILTIN_OP(name, minVersion, maxVersion)                           \
+    resolver->AddBuiltin(tflite::BuiltinOperator_##name,                       \
+                         tflite::ops::builtin::Register_##name(), minVersion,  \
+                         maxVersion);
+#define IZU_CUSTOM_OP(name, kernel, minVersion, maxVersion)                    \
+    resolver->AddCustom(name, tflite::ops::custom::Register_##kernel(),        \
+                        minVersion, maxVersion);
+#include "ReducedOps.inc"
+#undef IZU_BUILTIN_OP
+#undef IZU_CUSTOM_OP
+
+    return resolver;
+}
+
+} // namespace
+#else
+namespace {
+
+std::unique_ptr<tflite::OpResolver> makeResolver()
+{
+    return std::make_unique<tflite::ops::builtin::BuiltinOpResolver>();
+}
+
+} // namespace
+#endif
+
+const tflite::OpResolver &opResolver()
+{
+    static const std::unique_ptr<tflite::OpResolver> resolver = makeResolver();
+    return *resolver;
+}
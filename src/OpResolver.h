@@ -0,0 +1,11 @@
+#pragma once
+
+#include "tensorflow/lite/model.h"
+
+// The op resolver every interpreter is built with, created once per process.
+//
+// Normally this registers all builtin ops. A REDUCED_OPS build registers only
+// the ops listed in src/ReducedOps.inc, as generated by the opresolver tool
+// for the models that will be run, so the linker can leave out every other
+// kernel and startup skips registering them.
+const tflite::OpResolver &opResolver();
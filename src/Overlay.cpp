@@ -0,0 +1,133 @@
+#include "Overlay.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+OverlayRenderer::OverlayRenderer(const string &labelsFile)
+{
+    TIMER
+
+    const int FONT = cv::FONT_HERSHEY_SIMPLEX;
+    const double FONT_SCALE = 0.5;
+
+    vector<string> labels;
+    size_t labelCount;
+    ReadLabelsFile(labelsFile, &labels, &labelCount);
+    labels.resize(labelCount);
+
+    for (const auto &label : labels) {
+        Glyph glyph;
+        if (!label.empty()) {
+            int baseline = 0;
+            cv::Size size = cv::getTextSize(label, FONT, FONT_SCALE, 1,
+                                            &baseline);
+            glyph.ascent = size.height;
+            glyph.mask = cv::Mat::zeros(size.height + baseline, size.width,
+                                        CV_8UC1);
+            cv::putText(glyph.mask, label, cv::Point(0, size.height), FONT,
+                        FONT_SCALE, cv::Scalar(255));
+        }
+        mGlyphs.push_back(glyph);
+    }
+}
+
+void OverlayRenderer::addSpan(int row, int x0, int x1, const uint8_t *mask,
+                              const uint8_t *color, int width, int height)
+{
+    if (row < 0 || row >= height)
+        return;
+    if (x0 < 0) {
+        if (mask)
+            mask -= x0;
+        x0 = 0;
+    }
+    x1 = min(x1, width - 1);
+    if (x0 > x1)
+        return;
+
+    if (mRows[row].empty())
+        mTouched.push_back(row);
+    mRows[row].push_back({x0, x1, mask, color});
+}
+
+void OverlayRenderer::draw(cv::Mat &frame, const Detections &detections,
+                           float minScore)
+{
+    TIMER
+
+    if (frame.type() != CV_8UC3)
+        errExit("Overlay renderer expects 8 bit BGR frames.");
+
+    const int width = frame.cols;
+    const int height = frame.rows;
+    if (mRows.size() < static_cast<size_t>(height))
+        mRows.resize(height);
+    mTouched.clear();
+
+    // Collect the spans of all annotations.
+    for (size_t i = 0; i < detections.count; ++i) {
+        if (detections.scores[i] <= minScore)
+            continue;
+
+        const BoundingBox &box = detections.boxes[i];
+        int x0 = static_cast<int>(box.left * width);
+        int x1 = static_cast<int>(box.right * width);
+        int y0 = static_cast<int>(box.top * height);
+        int y1 = static_cast<int>(box.bottom * height);
+        if (x0 > x1)
+            swap(x0, x1);
+        if (y0 > y1)
+            swap(y0, y1);
+
+        addSpan(y0, x0, x1, nullptr, mBoxColor, width, height);
+        if (y1 != y0)
+            addSpan(y1, x0, x1, nullptr, mBoxColor, width, height);
+        for (int y = max(y0 + 1, 0); y < min(y1, height); ++y) {
+            addSpan(y, x0, x0, nullptr, mBoxColor, width, height);
+            addSpan(y, x1, x1, nullptr, mBoxColor, width, height);
+        }
+
+        int classId = detections.classes[i];
+        if (classId < 0 || classId >= static_cast<int>(mGlyphs.size())) {
+            cout << "[ERROR]: class id not found!\n";
+            continue;
+        }
+        const Glyph &glyph = mGlyphs[classId];
+        // The label's baseline sits on the box's top left corner.
+        for (int r = 0; r < glyph.mask.rows; ++r)
+            addSpan(y0 - glyph.ascent + r, x0, x0 + glyph.mask.cols - 1,
+                    glyph.mask.ptr<uint8_t>(r), mTextColor, width, height);
+    }
+
+    // Blend everything in one pass over the touched rows.
+    sort(mTouched.begin(), mTouched.end());
+    for (int row : mTouched) {
+        uint8_t *pixels = frame.ptr<uint8_t>(row);
+        for (const Span &span : mRows[row]) {
+            uint8_t *p = pixels + 3 * span.x0;
+            const uint8_t *c = span.color;
+            if (!span.mask) {
+                for (int x = span.x0; x <= span.x1; ++x, p += 3) {
+                    p[0] = c[0];
+                    p[1] = c[1];
+                    p[2] = c[2];
+                }
+                continue;
+            }
+
+            const uint8_t *m = span.mask;
+            for (int x = span.x0; x <= span.x1; ++x, p += 3, ++m) {
+                const int a = *m;
+                if (a == 0)
+                    continue;
+                p[0] += (c[0] - p[0]) * a / 255;
+                p[1] += (c[1] - p[1]) * a / 255;
+                p[2] += (c[2] - p[2]) * a / 255;
+            }
+        }
+        mRows[row].clear();
+    }
+}
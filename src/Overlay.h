@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Detections.h"
+
+#include "opencv2/opencv.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Draws detection boxes and labels onto BGR frames.
+//
+// Label text is rasterised once per class when the renderer is created, and
+// every draw() call first collects clipped row spans for all annotations and
+// then blends them in a single pass over the touched rows. This avoids a
+// cv::rectangle()/cv::putText() call per detection.
+class OverlayRenderer {
+  public:
+    OverlayRenderer(const std::string &labelsFile);
+
+    void draw(cv::Mat &frame, const Detections &detections, float minScore);
+
+  private:
+    struct Glyph {
+        cv::Mat mask;   // CV_8UC1 coverage of the label text.
+        int ascent = 0; // Rows above the baseline.
+    };
+
+    // A run of pixels [x0, x1] on one row, either solid or blended through
+    // a mask row.
+    struct Span {
+        int x0;
+        int x1;
+        const uint8_t *mask;
+        const uint8_t *color;
+    };
+
+    void addSpan(int row, int x0, int x1, const uint8_t *mask,
+                 const uint8_t *color, int width, int height);
+
+    std::vector<Glyph> mGlyphs;
+    std::vector<std::vector<Span>> mRows; // Spans per frame row.
+    std::vector<int> mTouched;            // Rows that have spans.
+
+    uint8_t mBoxColor[3] = {0, 255, 0};    // BGR
+    uint8_t mTextColor[3] = {255, 255, 0}; // BGR
+};
@@ -0,0 +1,104 @@
+#include "ResultCache.h"
+#include "MappedFile.h"
+#include "utils.h"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+struct RecordHeader {
+    uint32_t magic = 0x43555A49; // "IZUC"
+    uint32_t count = 0;          // ResultEntry records following.
+    uint64_t modelHash = 0;
+    uint64_t preprocessHash = 0;
+    uint64_t imageHash = 0;
+    uint64_t checksum = 0; // hashBytes() of the entries.
+};
+
+struct ResultEntry {
+    float score;
+    int32_t index;
+};
+
+} // namespace
+
+ResultCache::ResultCache(const string &file) : mFileName(file)
+{
+    size_t valid = 0;
+    {
+        MappedFile mapped;
+        if (mapped.open(file.c_str())) {
+            const uint8_t *data = mapped.data();
+            const size_t size = mapped.size();
+            RecordHeader header;
+            while (valid + sizeof(header) <= size) {
+                memcpy(&header, data + valid, sizeof(header));
+                size_t bytes = header.count * sizeof(ResultEntry);
+                const uint8_t *entries = data + valid + sizeof(header);
+                if (header.magic != RecordHeader().magic ||
+                    valid + sizeof(header) + bytes > size ||
+                    hashBytes(entries, bytes) != header.checksum)
+                    break;
+
+                Results &results = mResults[{header.modelHash,
+                                             header.preprocessHash,
+                                             header.imageHash}];
+                results.resize(header.count);
+                for (size_t i = 0; i < header.count; ++i) {
+                    ResultEntry entry;
+                    memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+                    results[i] = {entry.score, entry.index};
+                }
+                valid += sizeof(header) + bytes;
+            }
+            if (valid != size)
+                cerr << "[WARNING]: Dropping " << size - valid
+                     << " bytes of torn records at the end of " << file
+                     << "\n";
+
+            // Appending after a torn record would hide everything added later.
+            if (valid != size && truncate(file.c_str(), valid) != 0)
+                errExit("Couldn't truncate result cache " + file);
+        }
+    }
+
+    mFile.open(file, ios::binary | ios::app);
+    if (!mFile)
+        errExit("Couldn't open result cache " + file);
+}
+
+const ResultCache::Results *ResultCache::find(const ResultKey &key) const
+{
+    auto it = mResults.find(key);
+    return it == mResults.end() ? nullptr : &it->second;
+}
+
+void ResultCache::add(const ResultKey &key, const Results &results)
+{
+    vector<ResultEntry> entries;
+    entries.reserve(results.size());
+    for (const auto &[score, index] : results)
+        entries.push_back({score, index});
+
+    RecordHeader header;
+    header.count = entries.size();
+    header.modelHash = key.modelHash;
+    header.preprocessHash = key.preprocessHash;
+    header.imageHash = key.imageHash;
+    header.checksum =
+        hashBytes(entries.data(), entries.size() * sizeof(ResultEntry));
+
+    mFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    mFile.write(reinterpret_cast<const char *>(entries.data()),
+                entries.size() * sizeof(ResultEntry));
+    mFile.flush();
+    if (!mFile)
+        errExit("Failed writing result cache " + mFileName);
+
+    mResults[key] = results;
+}
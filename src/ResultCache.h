@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// What a classification result depends on.
+struct ResultKey {
+    uint64_t modelHash = 0;      // hashFile() of the model.
+    uint64_t preprocessHash = 0; // Input shape, type, resizing and top-K.
+    uint64_t imageHash = 0;      // hashFile() of the image.
+
+    bool operator==(const ResultKey &o) const
+    {
+        return modelHash == o.modelHash && preprocessHash == o.preprocessHash &&
+               imageHash == o.imageHash;
+    }
+};
+
+// On-disk cache of top-K classification results, addressed by content so
+// duplicate images and re-runs of interrupted jobs skip decoding, resizing
+// and inference.
+//
+// The file is append-only and every record is flushed when added, so results
+// survive a crash. A torn record at the end is ignored when opening and
+// overwritten by the next one.
+class ResultCache {
+  public:
+    using Results = std::vector<std::pair<float, int>>;
+
+    // Loads the existing records and opens the file for appending.
+    ResultCache(const std::string &file);
+
+    // nullptr if there's no result for this key.
+    const Results *find(const ResultKey &key) const;
+    void add(const ResultKey &key, const Results &results);
+    size_t size() const { return mResults.size(); }
+
+  private:
+    struct KeyHash {
+        size_t operator()(const ResultKey &key) const
+        {
+            return key.imageHash ^ (key.modelHash * 31) ^
+                   (key.preprocessHash * 131);
+        }
+    };
+
+    std::string mFileName;
+    std::ofstream mFile;
+    std::unordered_map<ResultKey, Results, KeyHash> mResults;
+};
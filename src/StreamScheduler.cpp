@@ -0,0 +1,330 @@
+#include "StreamScheduler.h"
+#include "Trace.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+StreamScheduler::StreamScheduler() {}
+
+StreamScheduler::~StreamScheduler() { stop(); }
+
+void StreamScheduler::loadModel(const char *modelFile, size_t workers,
+                                int threadsPerWorker)
+{
+    TIMER
+
+    mModel.reset();
+    mInterpreters.clear();
+    workers = max<size_t>(workers, 1);
+    for (size_t i = 0; i < workers; ++i) {
+        // Interpreter threads inherit the mask of the thread that builds
+        // them.
+        ScopedAffinity pin(mPlacement.inferenceCpusFor(i, workers));
+
+        auto tfLite = make_unique<TfLite>();
+        // The GL delegate is bound to the thread that created it, so the
+        // pool runs on the CPU.
+        tfLite->setBackend(TfLite::Backend::Cpu);
+        tfLite->setNumThreads(threadsPerWorker);
+        tfLite->setMemoryNode(mPlacement.memoryNode);
+        if (mModel) {
+            tfLite->loadModel(mModel);
+        }
+        else {
+            tfLite->loadModel(modelFile);
+            mModel = tfLite->getModel();
+        }
+        mInterpreters.push_back(move(tfLite));
+    }
+
+    vector<int> dims = mInterpreters.front()->getInputDims();
+    if (dims.size() != 4 || dims[3] != 3)
+        errExit("Stream scheduler expects a [1, height, width, 3] input.");
+    mInputSize = cv::Size(dims[2], dims[1]);
+
+    mInferenceTime = &mMetrics.histogram("izu_inference_seconds",
+                                         "Duration of one Invoke().");
+    mBusyWorkers = &mMetrics.gauge("izu_busy_workers",
+                                   "Interpreters currently running.");
+    mMetrics.gauge("izu_workers", "Interpreters in the pool.")
+        .set(mInterpreters.size());
+    mMetrics.gaugeFunction(
+        "izu_interpreter_utilisation",
+        "Fraction of pool time spent in Invoke() since the last scrape.",
+        utilisationOf(*mInferenceTime, mInterpreters.size()));
+}
+
+size_t StreamScheduler::addStream(const StreamConfig &config)
+{
+    if (mRunning)
+        errExit("Can't add streams to a running scheduler.");
+
+    auto stream = make_unique<Stream>();
+    stream->config = config;
+
+    const string &src = config.source;
+    bool isIndex = !src.empty() && all_of(src.begin(), src.end(), ::isdigit);
+    bool opened = isIndex ? stream->capture.open(stoi(src))
+                          : stream->capture.open(src);
+    if (!opened)
+        errExit("Couldn't open stream " + src);
+
+    stream->latencies.resize(LATENCY_SAMPLES, 0.0);
+
+    string label = "stream=\"" + to_string(mStreams.size()) + "\"";
+    stream->captured = &mMetrics.counter(
+        "izu_frames_captured_total", "Frames read from the source.", label);
+    stream->skipped = &mMetrics.counter(
+        "izu_frames_skipped_total",
+        "Frames not offered because of the fps target.", label);
+    stream->dropped = &mMetrics.counter(
+        "izu_frames_dropped_total",
+        "Offered frames replaced before a worker took them.", label);
+    stream->inferred = &mMetrics.counter("izu_frames_inferred_total",
+                                         "Frames that were inferred.", label);
+    stream->queued = &mMetrics.gauge(
+        "izu_queued_frames", "Frames waiting for a worker.", label);
+    stream->latency =
+        &mMetrics.histogram("izu_frame_latency_seconds",
+                            "Capture to inference result latency.", label);
+    mStreams.push_back(move(stream));
+    return mStreams.size() - 1;
+}
+
+void StreamScheduler::start()
+{
+    if (mInterpreters.empty())
+        errExit("Load a model before starting the stream scheduler.");
+
+    mRunning = true;
+    for (auto &stream : mStreams)
+        stream->thread = thread(&StreamScheduler::captureLoop, this,
+                                ref(*stream));
+    for (size_t i = 0; i < mInterpreters.size(); ++i)
+        mWorkers.emplace_back(&StreamScheduler::workerLoop, this, i);
+}
+
+void StreamScheduler::stop()
+{
+    mRunning = false;
+    mReady.notify_all();
+
+    for (auto &stream : mStreams)
+        if (stream->thread.joinable())
+            stream->thread.join();
+    for (auto &worker : mWorkers)
+        if (worker.joinable())
+            worker.join();
+    mWorkers.clear();
+}
+
+void StreamScheduler::captureLoop(Stream &stream)
+{
+    const auto interval =
+        stream.config.targetFps > 0.0
+            ? chrono::duration_cast<Clock::duration>(
+                  chrono::duration<double>(1.0 / stream.config.targetFps))
+            : Clock::duration::zero();
+    Clock::time_point nextOffer = Clock::now();
+    cv::Mat frame, rgb, input;
+
+    traceThreadName("capture");
+    pinCurrentThread(mPlacement.captureAndPreprocess());
+    preferMemoryNode(mPlacement.memoryNode);
+
+    while (mRunning) {
+        // Always drain the source so that offered frames are fresh.
+        {
+            TRACE_SCOPE("capture")
+            if (!stream.capture.read(frame) || frame.empty())
+                break;
+        }
+
+        Clock::time_point now = Clock::now();
+        stream.captured->inc();
+        if (now < nextOffer) {
+            stream.skipped->inc();
+            lock_guard<mutex> lock(mMutex);
+            ++stream.stats.captured;
+            ++stream.stats.skipped;
+            continue;
+        }
+        nextOffer = max(nextOffer + interval, now);
+
+        {
+            TRACE_SCOPE("preprocess")
+            cv::cvtColor(frame, rgb, CV_BGR2RGB);
+            cv::resize(rgb, input, mInputSize, 0, 0, cv::INTER_LINEAR);
+        }
+
+        {
+            lock_guard<mutex> lock(mMutex);
+            ++stream.stats.captured;
+            if (stream.pending) {
+                ++stream.stats.dropped;
+                stream.dropped->inc();
+            }
+            else {
+                // Don't let an idle stream bank credit in fair-share mode.
+                double minPass = stream.pass;
+                for (const auto &s : mStreams)
+                    if (s->pending)
+                        minPass = min(minPass, s->pass);
+                stream.pass = max(stream.pass, minPass);
+            }
+            stream.pending = true;
+            stream.queued->set(1);
+            stream.frame = frame;
+            stream.input = input;
+            stream.captureTime = now;
+        }
+        // Hand the buffers over to the workers; the next read allocates new
+        // ones instead of overwriting a frame that's still being inferred.
+        frame = cv::Mat();
+        input = cv::Mat();
+        mReady.notify_one();
+    }
+}
+
+vector<StreamScheduler::Job> StreamScheduler::takeJobs()
+{
+    vector<size_t> ready;
+    for (size_t i = 0; i < mStreams.size(); ++i)
+        if (mStreams[i]->pending)
+            ready.push_back(i);
+
+    auto before = [this](size_t a, size_t b) {
+        const Stream &sa = *mStreams[a];
+        const Stream &sb = *mStreams[b];
+        if (mPolicy == Policy::Priority) {
+            if (sa.config.priority != sb.config.priority)
+                return sa.config.priority > sb.config.priority;
+        }
+        else if (sa.pass != sb.pass) {
+            return sa.pass < sb.pass;
+        }
+        return sa.captureTime < sb.captureTime;
+    };
+    sort(ready.begin(), ready.end(), before);
+    if (ready.size() > mMaxBatch)
+        ready.resize(mMaxBatch);
+
+    vector<Job> jobs;
+    for (size_t i : ready) {
+        Stream &stream = *mStreams[i];
+        stream.pending = false;
+        stream.queued->set(0);
+        stream.pass += 1.0 / max(stream.config.weight, 1e-6);
+        jobs.push_back({i, stream.frame, stream.input, stream.captureTime});
+    }
+    return jobs;
+}
+
+void StreamScheduler::workerLoop(size_t worker)
+{
+    TfLite &tfLite = *mInterpreters[worker];
+    vector<cv::Mat> inputs;
+
+    traceThreadName("worker");
+    pinCurrentThread(mPlacement.inferenceCpusFor(worker, mInterpreters.size()));
+    preferMemoryNode(mPlacement.memoryNode);
+
+    while (true) {
+        vector<Job> jobs;
+        {
+            unique_lock<mutex> lock(mMutex);
+            mReady.wait(lock, [this] {
+                if (!mRunning)
+                    return true;
+                for (const auto &s : mStreams)
+                    if (s->pending)
+                        return true;
+                return false;
+            });
+            if (!mRunning)
+                return;
+            jobs = takeJobs();
+        }
+
+        inputs.clear();
+        for (const auto &job : jobs)
+            inputs.push_back(job.input);
+
+        mBusyWorkers->add(1);
+        auto start = Clock::now();
+        if (inputs.size() == 1)
+            tfLite.runInference(inputs.front());
+        else
+            tfLite.runInference(inputs);
+        chrono::duration<double, milli> inference = Clock::now() - start;
+        mBusyWorkers->add(-1);
+        mInferenceTime->observe(inference.count() / 1000.0);
+
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            if (mCallback) {
+                InferenceResult result = tfLite.copyOutputs(i, jobs.size());
+                result.inferenceMs = inference.count();
+                mCallback(jobs[i].stream, jobs[i].frame, result);
+            }
+
+            chrono::duration<double, milli> latency =
+                Clock::now() - jobs[i].captureTime;
+            Stream &stream = *mStreams[jobs[i].stream];
+            stream.inferred->inc();
+            stream.latency->observe(latency.count() / 1000.0);
+            lock_guard<mutex> lock(mMutex);
+            recordLatency(stream, latency.count());
+        }
+    }
+}
+
+void StreamScheduler::recordLatency(Stream &stream, double ms)
+{
+    StreamStats &stats = stream.stats;
+    ++stats.inferred;
+    stats.maxLatencyMs = max(stats.maxLatencyMs, ms);
+
+    double &slot = stream.latencies[stream.latencyPos % LATENCY_SAMPLES];
+    stream.latencySum += ms - slot;
+    slot = ms;
+    ++stream.latencyPos;
+}
+
+StreamStats StreamScheduler::getStats(size_t stream) const
+{
+    lock_guard<mutex> lock(mMutex);
+    const Stream &s = *mStreams.at(stream);
+    StreamStats stats = s.stats;
+
+    size_t samples = min(s.latencyPos, LATENCY_SAMPLES);
+    if (samples > 0) {
+        vector<double> sorted(s.latencies.begin(),
+                              s.latencies.begin() + samples);
+        size_t idx = min(samples - 1, samples * 99 / 100);
+        nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+        stats.p99LatencyMs = sorted[idx];
+        stats.meanLatencyMs = s.latencySum / samples;
+    }
+    return stats;
+}
+
+void StreamScheduler::printStats() const
+{
+    cout << "stream  captured  skipped  dropped  inferred  mean ms   p99 ms   "
+            "max ms\n";
+    cout << fixed << setprecision(1);
+    for (size_t i = 0; i < mStreams.size(); ++i) {
+        StreamStats s = getStats(i);
+        cout << setw(6) << i << setw(10) << s.captured << setw(9) << s.skipped
+             << setw(9) << s.dropped << setw(10) << s.inferred << setw(9)
+             << s.meanLatencyMs << setw(9) << s.p99LatencyMs << setw(9)
+             << s.maxLatencyMs << "\n";
+    }
+    cout << defaultfloat;
+}
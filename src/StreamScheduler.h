@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Metrics.h"
+#include "TfLite.h"
+#include "Topology.h"
+
+#include "opencv2/opencv.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct StreamConfig {
+    std::string source;     // Camera index ("0") or a video file/URL.
+    double targetFps = 0.0; // Frames offered per second, 0 offers all.
+    int priority = 0;       // Higher is served first in priority mode.
+    double weight = 1.0;    // Relative share of the pool in fair-share mode.
+};
+
+struct StreamStats {
+    size_t captured = 0; // Frames read from the source.
+    size_t skipped = 0;  // Frames not offered because of the fps target.
+    size_t dropped = 0;  // Offered frames replaced before a worker took them.
+    size_t inferred = 0; // Frames that went through the interpreter.
+    double meanLatencyMs = 0.0;
+    double p99LatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+};
+
+// Multiplexes several frame sources onto a pool of CPU interpreters that all
+// share one loaded model.
+//
+// Every stream has its own capture thread that converts and resizes frames to
+// the model input and offers the latest one. Workers pick the next stream to
+// serve by priority or by weighted fair share, optionally batching frames from
+// several streams into one Invoke(). A stream only ever has one pending frame;
+// if a newer frame arrives before a worker takes it, the old one is dropped.
+class StreamScheduler {
+  public:
+    enum class Policy { Priority, FairShare };
+
+    // Called on a worker thread after inference with the frame's own slice
+    // of the outputs, also for batched runs.
+    using ResultCallback = std::function<void(
+        size_t stream, const cv::Mat &frame, const InferenceResult &result)>;
+
+    StreamScheduler();
+    ~StreamScheduler();
+
+    void loadModel(const char *modelFile, size_t workers, int threadsPerWorker);
+    size_t addStream(const StreamConfig &config);
+    void setPolicy(Policy policy) { mPolicy = policy; }
+    void setMaxBatch(size_t maxBatch) { mMaxBatch = maxBatch; }
+    void setResultCallback(ResultCallback callback) { mCallback = callback; }
+    // Capture threads, which also preprocess, run on the capture and
+    // preprocess CPUs. Each worker, including the threads TFLite spawns for
+    // it, runs on its share of the inference CPUs. Must be set before
+    // loadModel().
+    void setThreadPlacement(const ThreadPlacement &placement)
+    {
+        mPlacement = placement;
+    }
+
+    void start();
+    void stop();
+    bool running() const { return mRunning; }
+
+    StreamStats getStats(size_t stream) const;
+    void printStats() const;
+    // Live counters, queue depths and latency histograms, e.g. for a
+    // MetricsServer. Per-stream metrics are labelled with the stream index.
+    MetricsRegistry &metrics() { return mMetrics; }
+
+  private:
+    struct Stream {
+        StreamConfig config;
+        cv::VideoCapture capture;
+        std::thread thread;
+
+        // Guarded by mMutex.
+        bool pending = false;
+        cv::Mat frame;    // Latest captured frame in its original size.
+        cv::Mat input;    // Frame converted to the model input.
+        std::chrono::steady_clock::time_point captureTime;
+        double pass = 0.0; // Virtual time for fair-share scheduling.
+        StreamStats stats;
+        std::vector<double> latencies; // Ring of recent latencies in ms.
+        size_t latencyPos = 0;
+        double latencySum = 0.0;
+
+        // Registered by addStream().
+        Counter *captured;
+        Counter *skipped;
+        Counter *dropped;
+        Counter *inferred;
+        Gauge *queued;
+        Histogram *latency;
+    };
+
+    struct Job {
+        size_t stream;
+        cv::Mat frame;
+        cv::Mat input;
+        std::chrono::steady_clock::time_point captureTime;
+    };
+
+    void captureLoop(Stream &stream);
+    void workerLoop(size_t worker);
+    // Takes up to mMaxBatch pending frames in scheduling order. Must hold
+    // mMutex.
+    std::vector<Job> takeJobs();
+    void recordLatency(Stream &stream, double ms);
+
+    MetricsRegistry mMetrics;
+    Histogram *mInferenceTime = nullptr;
+    Gauge *mBusyWorkers = nullptr;
+
+    std::shared_ptr<tflite::FlatBufferModel> mModel;
+    std::vector<std::unique_ptr<TfLite>> mInterpreters;
+    std::vector<std::unique_ptr<Stream>> mStreams;
+    std::vector<std::thread> mWorkers;
+    cv::Size mInputSize;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mReady;
+    std::atomic<bool> mRunning{false};
+
+    Policy mPolicy = Policy::FairShare;
+    size_t mMaxBatch = 1;
+    ResultCallback mCallback;
+    ThreadPlacement mPlacement;
+
+    constexpr static size_t LATENCY_SAMPLES = 1024;
+};
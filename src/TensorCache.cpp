@@ -0,0 +1,178 @@
+#include "TensorCache.h"
+#include "utils.h"
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+constexpr char MAGIC[8] = {'I', 'Z', 'U', 'T', 'E', 'N', 'S', '1'};
+constexpr uint64_t ALIGNMENT = 64;
+constexpr int MAX_RANK = 6;
+
+struct FileHeader {
+    char magic[8];
+    uint64_t entryCount = 0;
+    uint64_t indexOffset = 0;   // IndexEntry[entryCount] starts here,
+    uint64_t stringsOffset = 0; // followed by the concatenated paths.
+};
+
+struct IndexEntry {
+    uint64_t contentHash;
+    uint64_t offset;
+    uint64_t bytes;
+    uint32_t pathOffset; // Relative to FileHeader::stringsOffset.
+    uint32_t pathSize;
+    int32_t type;
+    int32_t rank;
+    int32_t dims[MAX_RANK];
+};
+
+uint64_t alignUp(uint64_t value)
+{
+    return (value + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+} // namespace
+
+TensorCacheWriter::TensorCacheWriter(const string &file) : mFileName(file)
+{
+    mFile.open(file, ios::binary | ios::trunc);
+    if (!mFile)
+        errExit("Couldn't create tensor cache " + file);
+
+    // Placeholder, rewritten by finish() once the offsets are known.
+    FileHeader header;
+    mFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    mOffset = sizeof(header);
+}
+
+TensorCacheWriter::~TensorCacheWriter()
+{
+    if (!mFinished)
+        finish();
+}
+
+void TensorCacheWriter::add(const TensorKey &key, const void *data,
+                            size_t bytes)
+{
+    if (mFinished)
+        errExit("Tensor cache " + mFileName + " is already finished.");
+    if (key.dims.size() > MAX_RANK)
+        errExit("Tensor cache can't store tensors of rank " +
+                to_string(key.dims.size()));
+
+    static const char padding[ALIGNMENT] = {};
+    uint64_t start = alignUp(mOffset);
+    mFile.write(padding, start - mOffset);
+    mFile.write(static_cast<const char *>(data), bytes);
+    mOffset = start + bytes;
+
+    mEntries.push_back({key, start, bytes});
+}
+
+void TensorCacheWriter::finish()
+{
+    mFinished = true;
+
+    FileHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.entryCount = mEntries.size();
+    header.indexOffset = alignUp(mOffset);
+    header.stringsOffset =
+        header.indexOffset + mEntries.size() * sizeof(IndexEntry);
+
+    static const char padding[ALIGNMENT] = {};
+    mFile.write(padding, header.indexOffset - mOffset);
+
+    uint32_t pathOffset = 0;
+    for (const auto &e : mEntries) {
+        IndexEntry index = {};
+        index.contentHash = e.key.contentHash;
+        index.offset = e.offset;
+        index.bytes = e.bytes;
+        index.pathOffset = pathOffset;
+        index.pathSize = e.key.path.size();
+        index.type = e.key.type;
+        index.rank = e.key.dims.size();
+        copy(e.key.dims.begin(), e.key.dims.end(), index.dims);
+        mFile.write(reinterpret_cast<const char *>(&index), sizeof(index));
+        pathOffset += e.key.path.size();
+    }
+    for (const auto &e : mEntries)
+        mFile.write(e.key.path.data(), e.key.path.size());
+
+    mFile.seekp(0);
+    mFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    mFile.close();
+    if (!mFile)
+        errExit("Failed writing tensor cache " + mFileName);
+}
+
+bool TensorCache::open(const string &file)
+{
+    mEntries.clear();
+    mByPath.clear();
+    if (!mFile.open(file.c_str()))
+        return false;
+
+    const uint8_t *base = mFile.data();
+    const size_t size = mFile.size();
+    FileHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.stringsOffset > size ||
+        header.entryCount > size / sizeof(IndexEntry) ||
+        header.indexOffset + header.entryCount * sizeof(IndexEntry) !=
+            header.stringsOffset) {
+        cerr << "[WARNING]: " << file << " is not a valid tensor cache.\n";
+        return false;
+    }
+
+    mEntries.reserve(header.entryCount);
+    const auto *index =
+        reinterpret_cast<const IndexEntry *>(base + header.indexOffset);
+    const char *strings =
+        reinterpret_cast<const char *>(base + header.stringsOffset);
+    for (uint64_t i = 0; i < header.entryCount; ++i) {
+        const IndexEntry &e = index[i];
+        if (e.offset + e.bytes > header.indexOffset || e.rank < 0 ||
+            e.rank > MAX_RANK ||
+            header.stringsOffset + e.pathOffset + e.pathSize > size) {
+            cerr << "[WARNING]: " << file << " has a corrupt index.\n";
+            mEntries.clear();
+            mByPath.clear();
+            return false;
+        }
+        Entry entry;
+        entry.tensor = {e.contentHash, base + e.offset, e.bytes};
+        entry.dims.assign(e.dims, e.dims + e.rank);
+        entry.type = e.type;
+        mEntries.push_back(move(entry));
+        mByPath.emplace(string(strings + e.pathOffset, e.pathSize), i);
+    }
+    return true;
+}
+
+const TensorCache::Tensor *TensorCache::find(const string &path,
+                                             const vector<int> &dims,
+                                             int type) const
+{
+    auto range = mByPath.equal_range(path);
+    for (auto it = range.first; it != range.second; ++it) {
+        const Entry &e = mEntries[it->second];
+        if (e.type == type && e.dims == dims)
+            return &e.tensor;
+    }
+    return nullptr;
+}
+
+const TensorCache::Tensor *TensorCache::find(const TensorKey &key) const
+{
+    const Tensor *tensor = find(key.path, key.dims, key.type);
+    return tensor && tensor->contentHash == key.contentHash ? tensor : nullptr;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Identifies a preprocessed tensor: the source image it was made from and
+// the input shape and TfLiteType it was resized and converted to.
+struct TensorKey {
+    std::string path;
+    uint64_t contentHash = 0; // hashFile() of the source image.
+    std::vector<int> dims;
+    int type = 0;
+};
+
+// Writes a tensor cache: one file holding already resized input tensors in
+// model layout, followed by an index. Tensors are 64 byte aligned so they can
+// be copied straight from a mapping of the file.
+class TensorCacheWriter {
+  public:
+    TensorCacheWriter(const std::string &file);
+    // Calls finish() if that hasn't been done yet.
+    ~TensorCacheWriter();
+
+    void add(const TensorKey &key, const void *data, size_t bytes);
+    // Writes the index. Nothing can be added afterwards.
+    void finish();
+    size_t size() const { return mEntries.size(); }
+
+  private:
+    struct Entry {
+        TensorKey key;
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    std::string mFileName;
+    std::ofstream mFile;
+    std::vector<Entry> mEntries;
+    uint64_t mOffset = 0;
+    bool mFinished = false;
+};
+
+// Read side of the tensor cache. The file is memory mapped, so lookups
+// return pointers into the page cache and nothing is decoded or resized.
+class TensorCache {
+  public:
+    struct Tensor {
+        uint64_t contentHash;
+        const uint8_t *data;
+        size_t bytes;
+    };
+
+    // Returns false if the file doesn't exist or isn't a tensor cache.
+    bool open(const std::string &file);
+    // Returns the tensor made from path with the given shape and type, or
+    // nullptr. Compare contentHash with the source file to detect stale
+    // entries.
+    const Tensor *find(const std::string &path, const std::vector<int> &dims,
+                       int type) const;
+    // Like find(), but also requires the content hash to match.
+    const Tensor *find(const TensorKey &key) const;
+    size_t size() const { return mEntries.size(); }
+
+  private:
+    struct Entry {
+        Tensor tensor;
+        std::vector<int> dims;
+        int type;
+    };
+
+    MappedFile mFile;
+    std::vector<Entry> mEntries;
+    std::unordered_multimap<std::string, size_t> mByPath;
+};
@@ -1,50 +1,220 @@
 #include "TfLite.h"
+#include "FrameRecorder.h"
+#include "OpResolver.h"
+#include "Topology.h"
+#include "Trace.h"
+#include "TypedSession.h"
 #include "bmp.h"
 #include "utils.h"
 
 #include "tensorflow/lite/builtin_op_data.h"
 #include "tensorflow/lite/kernels/register.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
 using namespace std;
 
+namespace {
+
+// Reads the model into memory bound to a NUMA node and backed as the options
+// say. The buffer is freed together with the model.
+shared_ptr<tflite::FlatBufferModel>
+buildModelOnNode(const char *modelFile, int node, const PageOptions &options,
+                 bool verify)
+{
+    ifstream file(modelFile, ios::binary | ios::ate);
+    if (!file)
+        return nullptr;
+    size_t size = file.tellg();
+    file.seekg(0);
+
+    size_t mapped;
+    char *buffer =
+        static_cast<char *>(allocOnNode(size, node, options, mapped));
+    unique_ptr<tflite::FlatBufferModel> model;
+    if (file.read(buffer, size))
+        model = verify
+                    ? tflite::FlatBufferModel::VerifyAndBuildFromBuffer(buffer,
+                                                                        size)
+                    : tflite::FlatBufferModel::BuildFromBuffer(buffer, size);
+    if (!model) {
+        freeOnNode(buffer, mapped);
+        return nullptr;
+    }
+    return shared_ptr<tflite::FlatBufferModel>(
+        model.release(), [buffer, mapped](tflite::FlatBufferModel *m) {
+            delete m;
+            freeOnNode(buffer, mapped);
+        });
+}
+
+// Copies the frame into a tensor, row by row for views into larger images.
+void copyFrame(const cv::Mat &frame, uint8_t *dst)
+{
+    if (frame.isContinuous()) {
+        memcpy(dst, frame.data, frame.total() * frame.elemSize());
+        return;
+    }
+    size_t rowBytes = frame.cols * frame.elemSize();
+    for (int row = 0; row < frame.rows; ++row, dst += rowBytes)
+        memcpy(dst, frame.ptr<uint8_t>(row), rowBytes);
+}
+
+} // namespace
+
 TfLite::TfLite() {}
 
-TfLite::~TfLite() {}
+TfLite::~TfLite()
+{
+    {
+        lock_guard<mutex> lock(mAsyncMutex);
+        mAsyncStop = true;
+    }
+    mAsyncCond.notify_all();
+    if (mAsyncThread.joinable())
+        mAsyncThread.join();
+
+    // The interpreter has to go before the delegate it was modified with.
+    mSession.reset();
+    mInterpreter.reset();
+    mDelegate.reset();
+}
 
 void TfLite::loadModel(const char *modelFile)
 {
     TIMER
 
-    mModel = tflite::FlatBufferModel::BuildFromFile(modelFile);
-    if (!mModel)
+    shared_ptr<tflite::FlatBufferModel> model =
+        buildModel(modelFile, false, false);
+    if (!model)
         errExit("Couldn't build model from " + string(modelFile));
 
-    tflite::ops::builtin::BuiltinOpResolver resolver;
-    tflite::InterpreterBuilder(*mModel, resolver)(&mInterpreter);
-    if (!mInterpreter)
+    loadModel(model);
+}
+
+bool TfLite::tryLoadModel(const char *modelFile, bool copy)
+{
+    TIMER
+
+    shared_ptr<tflite::FlatBufferModel> model =
+        buildModel(modelFile, true, copy);
+    if (!model)
+        return false;
+
+    loadModel(model);
+    return true;
+}
+
+shared_ptr<tflite::FlatBufferModel>
+TfLite::buildModel(const char *modelFile, bool verify, bool copy) const
+{
+    // The file mapping of BuildFromFile() can only have 4 KiB pages.
+    if (copy || mMemoryNode >= 0 || !mPageOptions.isDefault())
+        return buildModelOnNode(modelFile, mMemoryNode, mPageOptions, verify);
+    return verify ? tflite::FlatBufferModel::VerifyAndBuildFromFile(modelFile)
+                  : tflite::FlatBufferModel::BuildFromFile(modelFile);
+}
+
+void TfLite::loadModel(shared_ptr<tflite::FlatBufferModel> model)
+{
+    checkSynchronous();
+    mSession.reset();
+    mInterpreter.reset();
+    mDelegate.reset();
+    mModel = model;
+
+    tflite::InterpreterBuilder(*mModel, opResolver())(&mInterpreter);
+    if (!mInterpreter) {
+#ifdef REDUCED_OPS
+        errExit("Couldn't build interpreter. The model may use ops missing "
+                "from src/ReducedOps.inc, regenerate it with opresolver.");
+#else
         errExit("Couldn't build interpreter.");
+#endif
+    }
+
+    switch (mBackend) {
+    case Backend::Gpu: {
+        const TfLiteGpuDelegateOptions options = {
+            .metadata = NULL,
+            .compile_options =
+                {
+                    .precision_loss_allowed = mPrecisionLossAllowed ? 1 : 0,
+                    .preferred_gl_object_type = TFLITE_GL_OBJECT_TYPE_FASTEST,
+                    .dynamic_batch_enabled = 0,
+                    .inline_parameters = 0,
+                },
+        };
+        mDelegate = DelegatePtr(TfLiteGpuDelegateCreate(&options),
+                                TfLiteGpuDelegateDelete);
+        break;
+    }
+    case Backend::XnnPack: {
+#ifdef XNNPACK
+        TfLiteXNNPackDelegateOptions options =
+            TfLiteXNNPackDelegateOptionsDefault();
+        options.num_threads = mNumThreads;
+        mDelegate = DelegatePtr(TfLiteXNNPackDelegateCreate(&options),
+                                TfLiteXNNPackDelegateDelete);
+#else
+        errExit("Built without XNNPACK, rebuild with XNNPACK=1.");
+#endif
+        break;
+    }
+    case Backend::Cpu:
+        mInterpreter->SetAllowFp16PrecisionForFp32(mPrecisionLossAllowed);
+        break;
+    }
 
-    const TfLiteGpuDelegateOptions options = {
-        .metadata = NULL,
-        .compile_options =
-            {
-                .precision_loss_allowed = 1,
-                .preferred_gl_object_type = TFLITE_GL_OBJECT_TYPE_FASTEST,
-                .dynamic_batch_enabled = 0,
-                .inline_parameters = 0,
-            },
-    };
-    mDelegate.reset(TfLiteGpuDelegateCreate(&options));
-    if (mInterpreter->ModifyGraphWithDelegate(mDelegate.get()) != kTfLiteOk)
-        errExit("Couldn't modify graph with gpu delegate.");
+    if (mDelegate &&
+        mInterpreter->ModifyGraphWithDelegate(mDelegate.get()) != kTfLiteOk)
+        errExit("Couldn't modify graph with " + backendName(mBackend) +
+                " delegate.");
 
     // Increases performance on x86 to half the inference time.
-    mInterpreter->SetNumThreads(4);
+    mInterpreter->SetNumThreads(mNumThreads);
+    if (!mPageOptions.isDefault())
+        adviseArenas();
     printInterpreterInfo();
 }
 
+void TfLite::adviseArenas()
+{
+    // The arenas come from the heap, untouched until the first Invoke(), so
+    // they are located through the tensors planned into them.
+    if (mInterpreter->AllocateTensors() != kTfLiteOk)
+        errExit("Failed allocating tensors.");
+
+    for (TfLiteAllocationType arena :
+         {kTfLiteArenaRw, kTfLiteArenaRwPersistent}) {
+        uintptr_t begin = UINTPTR_MAX;
+        uintptr_t end = 0;
+        for (size_t i = 0; i < mInterpreter->tensors_size(); ++i) {
+            const TfLiteTensor *tensor = mInterpreter->tensor(i);
+            if (tensor->allocation_type != arena || !tensor->data.raw)
+                continue;
+            uintptr_t data = reinterpret_cast<uintptr_t>(tensor->data.raw);
+            begin = min(begin, data);
+            end = max(end, data + tensor->bytes);
+        }
+        if (begin < end)
+            advisePages(reinterpret_cast<void *>(begin), end - begin,
+                        mPageOptions);
+    }
+}
+
+void TfLite::setNumThreads(int threads)
+{
+    checkSynchronous();
+    mNumThreads = threads;
+    if (mInterpreter)
+        mInterpreter->SetNumThreads(mNumThreads);
+}
+
 void TfLite::printInterpreterInfo() const
 {
     cout << "Interpreter info:\n";
@@ -57,19 +227,41 @@ void TfLite::printInterpreterInfo() const
 void TfLite::runInference(const char *inputFile)
 {
     TIMER
+    checkSynchronous();
 
-    if (mInterpreter->AllocateTensors() != kTfLiteOk)
-        errExit("Failed allocating tensors.");
-
+    printInputOutputInfo();
     loadBmpImage(inputFile);
 
     // Running inference
+    TRACE_SCOPE("Invoke()")
     if (mInterpreter->Invoke() != kTfLiteOk)
         errExit("Failed to invoke tflite.");
 
     printTopResults();
 }
 
+void TfLite::loadInput(const void *data, size_t bytes)
+{
+    checkSynchronous();
+    if (mInterpreter->AllocateTensors() != kTfLiteOk)
+        errExit("Failed allocating tensors.");
+
+    TfLiteTensor *input = mInterpreter->tensor(mInterpreter->inputs()[0]);
+    if (input->bytes != bytes)
+        errExit("Input data has " + to_string(bytes) + " bytes, the tensor " +
+                to_string(input->bytes));
+    memcpy(input->data.raw, data, bytes);
+    recordInput();
+}
+
+void TfLite::invoke()
+{
+    checkSynchronous();
+    TRACE_SCOPE("Invoke()")
+    if (mInterpreter->Invoke() != kTfLiteOk)
+        errExit("Failed to invoke tflite.");
+}
+
 void TfLite::printOps() const
 {
     printf("Loading model\n");
@@ -92,8 +284,11 @@ void TfLite::printOps() const
 
 void TfLite::runInference(const cv::Mat &frame)
 {
-        if (mInterpreter->AllocateTensors() != kTfLiteOk)
-            errExit("Failed allocating tensors.");
+    checkSynchronous();
+    // A batched run leaves the input at its batch size.
+    resizeBatch(1);
+    if (mInterpreter->AllocateTensors() != kTfLiteOk)
+        errExit("Failed allocating tensors.");
 
     loadFrame(frame);
 
@@ -112,8 +307,158 @@ void TfLite::runInference(const cv::Mat &frame)
     // printTopResults();
 }
 
+void TfLite::runInference(const vector<cv::Mat> &frames)
+{
+    checkSynchronous();
+    int input = mInterpreter->inputs()[0];
+    int batch = static_cast<int>(frames.size());
+    if (batch == 0)
+        return;
+
+    resizeBatch(batch);
+    if (mInterpreter->AllocateTensors() != kTfLiteOk)
+        errExit("Failed allocating tensors.");
+
+    size_t inputSize = mInterpreter->tensor(input)->bytes / batch;
+    uint8_t *inputDataPtr = mInterpreter->typed_tensor<uint8_t>(input);
+    for (const auto &frame : frames) {
+        if (frame.total() * frame.elemSize() != inputSize)
+            errExit("Frame's byte size doesn't match the models input.");
+        copyFrame(frame, inputDataPtr);
+        inputDataPtr += inputSize;
+    }
+
+#ifdef TIME
+    {
+        Timer timer("Invoke() batch " + to_string(batch));
+#endif
+        if (mInterpreter->Invoke() != kTfLiteOk)
+            errExit("Failed to invoke tflite.");
+#ifdef TIME
+    }
+#endif
+}
+
+void TfLite::resizeBatch(int batch)
+{
+    int input = mInterpreter->inputs()[0];
+    TfLiteIntArray *dims = mInterpreter->tensor(input)->dims;
+    if (dims->size == 0 || dims->data[0] == batch)
+        return;
+
+    vector<int> newDims(dims->data, dims->data + dims->size);
+    newDims[0] = batch;
+    if (mInterpreter->ResizeInputTensor(input, newDims) != kTfLiteOk)
+        errExit("Couldn't resize input to batch size " + to_string(batch));
+}
+
+InferenceResult TfLite::copyOutputs(size_t batchIndex, size_t batchSize) const
+{
+    InferenceResult result;
+    for (int o : mInterpreter->outputs()) {
+        const TfLiteTensor *tensor = mInterpreter->tensor(o);
+        OutputTensor out;
+        out.type = tensor->type;
+        out.dims.assign(tensor->dims->data,
+                        tensor->dims->data + tensor->dims->size);
+
+        // Only outputs with a batch dimension are sliced, others like
+        // detection counts are shared by the whole batch.
+        size_t sliceBytes = tensor->bytes;
+        size_t offset = 0;
+        if (batchSize > 1 && !out.dims.empty() &&
+            out.dims[0] == static_cast<int>(batchSize)) {
+            out.dims[0] = 1;
+            sliceBytes /= batchSize;
+            offset = batchIndex * sliceBytes;
+        }
+        const uint8_t *src =
+            reinterpret_cast<const uint8_t *>(tensor->data.raw) + offset;
+        out.data.assign(src, src + sliceBytes);
+        result.outputs.push_back(move(out));
+    }
+    return result;
+}
+
+future<InferenceResult> TfLite::submit(cv::Mat frame)
+{
+    auto promise = make_shared<std::promise<InferenceResult>>();
+    future<InferenceResult> result = promise->get_future();
+    submit(move(frame), [promise](InferenceResult r) {
+        promise->set_value(move(r));
+    });
+    return result;
+}
+
+void TfLite::submit(cv::Mat frame, function<void(InferenceResult)> callback)
+{
+    if (!mInterpreter)
+        errExit("Load a model before submitting frames.");
+    if (mBackend == Backend::Gpu)
+        errExit("submit() can't run the GL delegate off its loading thread.");
+
+    unique_lock<mutex> lock(mAsyncMutex);
+    if (!mAsyncThread.joinable())
+        mAsyncThread = thread(&TfLite::asyncLoop, this);
+
+    mAsyncCond.wait(lock, [this] { return mAsyncJobs.size() < mMaxPending; });
+    mAsyncJobs.push_back({move(frame), move(callback)});
+    lock.unlock();
+    mAsyncCond.notify_all();
+}
+
+void TfLite::asyncLoop()
+{
+    while (true) {
+        AsyncJob job;
+        {
+            unique_lock<mutex> lock(mAsyncMutex);
+            mAsyncCond.wait(
+                lock, [this] { return mAsyncStop || !mAsyncJobs.empty(); });
+            if (mAsyncJobs.empty())
+                return;
+            job = move(mAsyncJobs.front());
+            mAsyncJobs.pop_front();
+        }
+        mAsyncCond.notify_all();
+
+        auto start = chrono::steady_clock::now();
+        runInference(job.frame);
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+
+        InferenceResult result = copyOutputs();
+        result.inferenceMs = elapsed.count();
+        job.callback(move(result));
+    }
+}
+
+void TfLite::checkSynchronous() const
+{
+    // Once started, the async thread owns the interpreter. It is assigned
+    // before the first job is queued under mAsyncMutex, so the thread itself
+    // always sees its own id here.
+    if (mAsyncThread.joinable() &&
+        this_thread::get_id() != mAsyncThread.get_id())
+        errExit("Synchronous inference on a TfLite that frames were "
+                "submitted to, use submit() only.");
+}
+
+std::vector<int> TfLite::getInputDims() const
+{
+    int input = mInterpreter->inputs()[0];
+    TfLiteIntArray *dims = mInterpreter->tensor(input)->dims;
+    return vector<int>(dims->data, dims->data + dims->size);
+}
+
+const TfLiteTensor *TfLite::getInputTensor() const
+{
+    return mInterpreter->tensor(mInterpreter->inputs()[0]);
+}
+
 std::vector<TfLiteTensor *> TfLite::getOutputs() const
 {
+    checkSynchronous();
     const vector<int> outputs = mInterpreter->outputs();
     vector<TfLiteTensor *> outputTensors;
 
@@ -169,93 +514,105 @@ void TfLite::loadFrame(const cv::Mat &frame)
     uint8_t *inputDataPtr = mInterpreter->typed_tensor<uint8_t>(input);
 
     // Assuming same layout:
-    for (size_t i = 0; i < inputSize; ++i) {
-        *(inputDataPtr + i) = *(frame.data + i);
-    }
+    copyFrame(frame, inputDataPtr);
 
-    if (mWriteInputBmp) {
-        TfLiteIntArray *dims = mInterpreter->tensor(input)->dims;
+    recordInput();
+}
 
-        int height = dims->data[1];
-        int width = dims->data[2];
-        int channels = dims->data[3];
-        writeBmp(width, height, channels,
-                 mInterpreter->typed_tensor<uint8_t>(input), "temp.bmp");
+void TfLite::setInputBmpExport(bool value)
+{
+    if (!value) {
+        mInputRecorder.reset();
+        return;
+    }
+    if (!mInputRecorder) {
+        FrameRecorder::Config config;
+        config.prefix = "input";
+        mInputRecorder = make_unique<FrameRecorder>(config);
     }
 }
 
+void TfLite::recordInput()
+{
+    FrameRecorder *recorder = mRecorder ? mRecorder : mInputRecorder.get();
+    if (!recorder)
+        return;
+
+    int input = mInterpreter->inputs()[0];
+    const TfLiteTensor *tensor = mInterpreter->tensor(input);
+    const TfLiteIntArray *dims = tensor->dims;
+    if (tensor->type == kTfLiteUInt8 && dims->size == 4)
+        recorder->record(tensor->data.uint8, dims->data[2], dims->data[1],
+                         dims->data[3], "input");
+    else
+        recorder->recordBytes(tensor->data.raw, tensor->bytes, "input");
+}
+
 void TfLite::loadBmpImage(const char *bmpFile)
 {
-    const vector<int> inputs = mInterpreter->inputs();
-    const vector<int> outputs = mInterpreter->outputs();
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    auto image = readBmp(bmpFile, &width, &height, &channels);
+    loadImage(image, width, height, channels);
+}
 
-    int input = inputs[0]; // Index of input tensor;
+void TfLite::loadBmpImage(const uint8_t *bmpData, size_t bytes)
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    auto image = decodeBmp(bmpData, bytes, &width, &height, &channels);
+    loadImage(image, width, height, channels);
+}
 
-    printInputOutputInfo();
-    TfLiteIntArray *dims = mInterpreter->tensor(input)->dims;
+void TfLite::loadImage(const vector<uint8_t> &image, int width, int height,
+                       int channels)
+{
+    checkSynchronous();
+    if (mInterpreter->AllocateTensors() != kTfLiteOk)
+        errExit("Failed allocating tensors.");
 
-    int wanted_height = dims->data[1];
-    int wanted_width = dims->data[2];
-    int wanted_channels = dims->data[3];
-
-    // Loading bmp image into buffer
-    int image_width = 0;
-    int image_height = 0;
-    int image_channels = 0;
-    auto in = readBmp(bmpFile, &image_width, &image_height, &image_channels);
-
-    switch (mInterpreter->tensor(input)->type) {
-    case kTfLiteFloat32:
-        resize<float>(mInterpreter->typed_tensor<float>(input), in.data(),
-                      image_height, image_width, image_channels, wanted_height,
-                      wanted_width, wanted_channels);
-        break;
-    case kTfLiteUInt8:
-        resize<uint8_t>(mInterpreter->typed_tensor<uint8_t>(input), in.data(),
-                        image_height, image_width, image_channels,
-                        wanted_height, wanted_width, wanted_channels);
-        break;
-    default:
-        cout << "[ERROR]: Cannot handle input type "
-             << mInterpreter->tensor(input)->type << " yet";
-        exit(-1);
-    }
-    if (mWriteInputBmp)
-        writeBmp(wanted_width, wanted_height, wanted_channels,
-                 mInterpreter->typed_tensor<uint8_t>(input), "temp.bmp");
+    session().loadImage(image.data(), width, height, channels);
+    recordInput();
 }
 
-void TfLite::printTopResults() const
+vector<pair<float, int>> TfLite::getTopResults(size_t results,
+                                                float threshold) const
 {
-    std::vector<std::pair<float, int>> top_results;
-
-    int output = mInterpreter->outputs()[0];
-    TfLiteIntArray *output_dims = mInterpreter->tensor(output)->dims;
-    // assume output dims to be something like (1, 1, ... ,size)
-    auto output_size = output_dims->data[output_dims->size - 1];
-    int results = 10;
-    float threshold = 0.001;
-    switch (mInterpreter->tensor(output)->type) {
-    case kTfLiteFloat32:
-        get_top_n<float>(mInterpreter->typed_output_tensor<float>(0),
-                         output_size, results, threshold, &top_results, true);
-        break;
-    case kTfLiteUInt8:
-        get_top_n<uint8_t>(mInterpreter->typed_output_tensor<uint8_t>(0),
-                           output_size, results, threshold, &top_results,
-                           false);
-        break;
-    default:
-        errExit("cannot handle output type " +
-                to_string(mInterpreter->tensor(output)->type) + " yet");
-        exit(-1);
-    }
+    return session().topResults(results, threshold);
+}
+
+bool TfLite::isImageModel(string *error) const
+{
+    string why = imageModelError(*mInterpreter);
+    if (error)
+        *error = why;
+    return why.empty();
+}
 
-    std::vector<string> labels;
-    size_t label_count;
+Session &TfLite::session() const
+{
+    // Only image classification needs one, so other models still load.
+    if (!mSession)
+        mSession = makeSession(*mInterpreter);
+    return *mSession;
+}
+
+void TfLite::printTopResults() const
+{
+    printTopResults(getTopResults(TOP_RESULTS, TOP_THRESHOLD));
+}
 
-    ReadLabelsFile("res/imageClass/labels_mobilenet_quant_v1_224.txt", &labels,
-                   &label_count);
+void TfLite::printTopResults(const vector<pair<float, int>> &top_results)
+{
+    // Read once; evaluation runs print results for every input.
+    static std::vector<string> labels;
+    if (labels.empty()) {
+        size_t label_count;
+        ReadLabelsFile("res/imageClass/labels_mobilenet_quant_v1_224.txt",
+                       &labels, &label_count);
+    }
 
     // Print top results
     cout << "\nObject detection results:\n";
@@ -265,3 +622,28 @@ void TfLite::printTopResults() const
         cout << confidence << ": " << index << " " << labels[index] << "\n";
     }
 }
+
+string backendName(TfLite::Backend backend)
+{
+    switch (backend) {
+    case TfLite::Backend::Cpu:
+        return "cpu";
+    case TfLite::Backend::Gpu:
+        return "gpu";
+    case TfLite::Backend::XnnPack:
+        return "xnnpack";
+    }
+    return "unknown";
+}
+
+TfLite::Backend parseBackend(const string &name)
+{
+    if (name == "cpu")
+        return TfLite::Backend::Cpu;
+    if (name == "gpu")
+        return TfLite::Backend::Gpu;
+    if (name == "xnnpack")
+        return TfLite::Backend::XnnPack;
+    errExit("Unknown backend " + name + ", expected cpu, gpu or xnnpack.");
+    return TfLite::Backend::Cpu;
+}
@@ -1,34 +1,180 @@
 #pragma once
 
+#include "Topology.h"
+
 #include "opencv2/opencv.hpp"
 #include "tensorflow/lite/delegates/gpu/gl_delegate.h"
 #include "tensorflow/lite/interpreter.h"
 #include "tensorflow/lite/model.h"
+#ifdef XNNPACK
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+class FrameRecorder;
+class Session;
+
+// Copy of an output tensor that stays valid after the interpreter runs again.
+struct OutputTensor {
+    TfLiteType type = kTfLiteNoType;
+    std::vector<int> dims;
+    std::vector<uint8_t> data;
+
+    template <class T> const T *as() const
+    {
+        return reinterpret_cast<const T *>(data.data());
+    }
+};
+
+struct InferenceResult {
+    std::vector<OutputTensor> outputs;
+    double inferenceMs = 0.0;
+};
 
 class TfLite {
   public:
+    enum class Backend { Cpu, Gpu, XnnPack };
+
+    constexpr static size_t TOP_RESULTS = 10;
+    constexpr static float TOP_THRESHOLD = 0.001f;
+
     TfLite();
     ~TfLite();
 
     void loadModel(const char *modelFile);
+    // Same, but verifies the file first and returns false instead of exiting
+    // when it doesn't hold a valid model. With copy the file is always read
+    // into memory owned by the model, never mapped, so rewriting the file in
+    // place can't change a model that is running.
+    bool tryLoadModel(const char *modelFile, bool copy = false);
+    // Builds an interpreter on top of an already loaded model. Several TfLite
+    // instances can share one model this way, so the weights are only mapped
+    // once per process.
+    void loadModel(std::shared_ptr<tflite::FlatBufferModel> model);
     void runInference(const char *inputFile);
+    // The frame may be a non-continuous view (ROI) into a larger image.
     void runInference(const cv::Mat &frame);
+    // Loads a BMP image into the loaded models input tensor.
+    void loadBmpImage(const char *bmpFile);
+    // Same for a whole BMP file already in memory.
+    void loadBmpImage(const uint8_t *bmpData, size_t bytes);
+    // Copies already preprocessed data, laid out like the input tensor, into
+    // it. Used for inputs coming from a TensorCache.
+    void loadInput(const void *data, size_t bytes);
+    // Runs the interpreter on whatever is in the input tensor.
+    void invoke();
+    // Runs the frames as one batch by resizing the input's first dimension.
+    // Only works for models whose ops accept a batch size other than 1.
+    void runInference(const std::vector<cv::Mat> &frames);
+    // The tensors point into interpreter memory and are overwritten by the
+    // next inference. Use copyOutputs() to keep the results around.
     std::vector<TfLiteTensor *> getOutputs() const;
+    // Copies slice batchIndex of every output after a run of batchSize frames.
+    // Outputs whose first dimension isn't the batch size are copied whole.
+    InferenceResult copyOutputs(size_t batchIndex = 0,
+                                size_t batchSize = 1) const;
+    std::vector<int> getInputDims() const;
+    // Valid after loadBmpImage() or loadInput().
+    const TfLiteTensor *getInputTensor() const;
+    // Top classification results of the first output, best first.
+    std::vector<std::pair<float, int>> getTopResults(size_t results,
+                                                     float threshold) const;
+    std::shared_ptr<tflite::FlatBufferModel> getModel() const { return mModel; }
+    // Whether loadBmpImage() and getTopResults() support the model's tensors,
+    // with the reason in error if not. Image programs call it right after
+    // loadModel(), since those calls exit on a model they don't support.
+    bool isImageModel(std::string *error = nullptr) const;
+
+    // Queues the frame for inference on a background thread and returns
+    // right away, so capture and post-processing can overlap with Invoke().
+    // The frame's buffer is shared, not copied: don't write into it until the
+    // result is delivered. Blocks while maxPending frames are queued. Needs
+    // the CPU interpreter since the GL delegate is tied to the loading thread.
+    // From the first submit() on, the interpreter belongs to the background
+    // thread: loading, running or reading outputs directly exits.
+    std::future<InferenceResult> submit(cv::Mat frame);
+    void submit(cv::Mat frame, std::function<void(InferenceResult)> callback);
+    void setMaxPending(size_t maxPending) { mMaxPending = maxPending; }
 
     void printOps() const;
+    // Prints the TOP_RESULTS best classes over TOP_THRESHOLD.
+    void printTopResults() const;
+    static void
+    printTopResults(const std::vector<std::pair<float, int>> &results);
     void printInputOutputInfo() const;
-    void setInputBmpExport(bool value) { mWriteInputBmp = value; }
+    // Writes every input tensor as a numbered BMP from a background thread.
+    void setInputBmpExport(bool value);
+    // Records every input tensor with a caller-owned recorder instead.
+    void setRecorder(FrameRecorder *recorder) { mRecorder = recorder; }
+    // Must be set before loadModel(). The GPU is the default.
+    void setBackend(Backend backend) { mBackend = backend; }
+    Backend getBackend() const { return mBackend; }
+    // Lets the GPU delegate compute in fp16 and the CPU use fp16 where it
+    // can. Must be set before loadModel().
+    void setPrecisionLossAllowed(bool value) { mPrecisionLossAllowed = value; }
+    // Copies the model weights into memory on this NUMA node instead of
+    // mapping the file. Must be set before loadModel().
+    void setMemoryNode(int node) { mMemoryNode = node; }
+    // Copies the model weights into memory backed as the options say, and
+    // applies them to the tensor arenas too. Must be set before loadModel().
+    void setPageOptions(const PageOptions &options) { mPageOptions = options; }
+    void setNumThreads(int threads);
+    int getNumThreads() const { return mNumThreads; }
 
   private:
-    // Loads a BMP image into the loaded models input tensor.
-    void loadBmpImage(const char *bmpFile);
+    using DelegatePtr =
+        std::unique_ptr<TfLiteDelegate, std::function<void(TfLiteDelegate *)>>;
+
+    // Maps the file, or copies it to the memory node and pages set.
+    std::shared_ptr<tflite::FlatBufferModel>
+    buildModel(const char *modelFile, bool verify, bool copy) const;
     void loadFrame(const cv::Mat &frame);
+    // Resizes the input's first dimension, AllocateTensors() must follow.
+    void resizeBatch(int batch);
+    void loadImage(const std::vector<uint8_t> &image, int width, int height,
+                   int channels);
+    // Exits if the model's tensors aren't supported for images.
+    Session &session() const;
     void printInterpreterInfo() const;
-    void printTopResults() const;
-    std::unique_ptr<tflite::FlatBufferModel> mModel;
+    void adviseArenas();
+    void recordInput();
+    void asyncLoop();
+    // Exits when called from outside the async thread once it runs.
+    void checkSynchronous() const;
+
+    struct AsyncJob {
+        cv::Mat frame;
+        std::function<void(InferenceResult)> callback;
+    };
+
+    std::shared_ptr<tflite::FlatBufferModel> mModel;
     std::unique_ptr<tflite::Interpreter> mInterpreter;
-    std::unique_ptr<TfLiteDelegate, std::function<void(TfLiteDelegate *)>>
-        mDelegate{nullptr,
-                  [](TfLiteDelegate *d) { TfLiteGpuDelegateDelete(d); }};
-    bool mWriteInputBmp = false;
+    // Image pre- and post-processing for the model's tensor types, made on
+    // the first image or top results.
+    mutable std::unique_ptr<Session> mSession;
+    DelegatePtr mDelegate{nullptr, [](TfLiteDelegate *) {}};
+    std::unique_ptr<FrameRecorder> mInputRecorder;
+    FrameRecorder *mRecorder = nullptr;
+    Backend mBackend = Backend::Gpu;
+    bool mPrecisionLossAllowed = true;
+    int mNumThreads = 4;
+    int mMemoryNode = -1;
+    PageOptions mPageOptions;
+
+    std::thread mAsyncThread;
+    std::mutex mAsyncMutex;
+    std::condition_variable mAsyncCond;
+    std::deque<AsyncJob> mAsyncJobs;
+    size_t mMaxPending = 2;
+    bool mAsyncStop = false;
 };
+
+std::string backendName(TfLite::Backend backend);
+// Parses "cpu", "gpu" or "xnnpack".
+TfLite::Backend parseBackend(const std::string &name);
@@ -0,0 +1,152 @@
+#include "TiledDetector.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+vector<int> tileStarts(int length, int tile, double overlap)
+{
+    if (length <= tile)
+        return {0};
+
+    int step = max(1, static_cast<int>(tile * (1.0 - overlap)));
+    vector<int> starts;
+    for (int pos = 0; pos + tile < length; pos += step)
+        starts.push_back(pos);
+    starts.push_back(length - tile);
+    return starts;
+}
+
+} // namespace
+
+vector<cv::Rect> makeTiles(cv::Size image, cv::Size tile, double overlap)
+{
+    tile.width = min(tile.width, image.width);
+    tile.height = min(tile.height, image.height);
+
+    vector<cv::Rect> tiles;
+    for (int y : tileStarts(image.height, tile.height, overlap))
+        for (int x : tileStarts(image.width, tile.width, overlap))
+            tiles.emplace_back(x, y, tile.width, tile.height);
+    return tiles;
+}
+
+TiledDetector::TiledDetector() {}
+
+TiledDetector::~TiledDetector() {}
+
+void TiledDetector::loadModel(const char *modelFile, size_t workers,
+                              int threadsPerWorker)
+{
+    TIMER
+
+    mInterpreters.clear();
+    shared_ptr<tflite::FlatBufferModel> model;
+    for (size_t i = 0; i < max<size_t>(workers, 1); ++i) {
+        auto tfLite = make_unique<TfLite>();
+        tfLite->setBackend(TfLite::Backend::Cpu);
+        tfLite->setNumThreads(threadsPerWorker);
+        if (model) {
+            tfLite->loadModel(model);
+        }
+        else {
+            tfLite->loadModel(modelFile);
+            model = tfLite->getModel();
+        }
+        mInterpreters.push_back(move(tfLite));
+    }
+
+    vector<int> dims = mInterpreters.front()->getInputDims();
+    if (dims.size() != 4 || dims[3] != 3)
+        errExit("Tiled detection expects a [1, height, width, 3] input.");
+    mInputSize = cv::Size(dims[2], dims[1]);
+}
+
+vector<Detection> TiledDetector::detect(const cv::Mat &image,
+                                        const TilingConfig &config)
+{
+    TIMER
+
+    if (mInterpreters.empty())
+        errExit("Load a model before running tiled detection.");
+
+    // Convert once; tiles are views into this.
+    cv::Mat rgb;
+    cv::cvtColor(image, rgb, CV_BGR2RGB);
+
+    cv::Size tileSize(
+        static_cast<int>(mInputSize.width * config.tileScale),
+        static_cast<int>(mInputSize.height * config.tileScale));
+    const vector<cv::Rect> tiles =
+        makeTiles(cv::Size(rgb.cols, rgb.rows), tileSize, config.overlap);
+
+    const float width = static_cast<float>(rgb.cols);
+    const float height = static_cast<float>(rgb.rows);
+    atomic<size_t> next{0};
+    vector<vector<Detection>> found(mInterpreters.size());
+
+    auto work = [&](size_t worker) {
+        TfLite &tfLite = *mInterpreters[worker];
+        // The next tile is cut and resized while the previous one is
+        // inferred, so the resize buffers alternate.
+        cv::Mat resized[2];
+        future<InferenceResult> pending;
+        cv::Rect pendingRect;
+        auto collect = [&] {
+            Detections d = decodeDetections(pending.get());
+            const cv::Rect &rect = pendingRect;
+            for (size_t j = 0; j < d.count; ++j) {
+                if (d.scores[j] < config.minScore)
+                    continue;
+                const BoundingBox &b = d.boxes[j];
+                Detection det;
+                det.box.top = (rect.y + b.top * rect.height) / height;
+                det.box.left = (rect.x + b.left * rect.width) / width;
+                det.box.bottom = (rect.y + b.bottom * rect.height) / height;
+                det.box.right = (rect.x + b.right * rect.width) / width;
+                det.classId = d.classes[j];
+                det.score = d.scores[j];
+                found[worker].push_back(det);
+            }
+        };
+
+        size_t submitted = 0;
+        for (size_t i = next++; i < tiles.size(); i = next++) {
+            const cv::Rect &rect = tiles[i];
+            cv::Mat input = rgb(rect);
+            if (rect.width != mInputSize.width ||
+                rect.height != mInputSize.height) {
+                cv::Mat &buffer = resized[submitted % 2];
+                cv::resize(input, buffer, mInputSize, 0, 0, cv::INTER_AREA);
+                input = buffer;
+            }
+
+            future<InferenceResult> result = tfLite.submit(input);
+            ++submitted;
+            if (pending.valid())
+                collect();
+            pending = move(result);
+            pendingRect = rect;
+        }
+        if (pending.valid())
+            collect();
+    };
+
+    vector<thread> threads;
+    for (size_t w = 1; w < mInterpreters.size(); ++w)
+        threads.emplace_back(work, w);
+    work(0);
+    for (auto &t : threads)
+        t.join();
+
+    vector<Detection> all;
+    for (const auto &f : found)
+        all.insert(all.end(), f.begin(), f.end());
+    return nms(move(all), config.nmsIou);
+}
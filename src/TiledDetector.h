@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Detections.h"
+#include "TfLite.h"
+
+#include "opencv2/opencv.hpp"
+
+#include <memory>
+#include <vector>
+
+struct TilingConfig {
+    double overlap = 0.25;  // Fraction of a tile shared with its neighbour.
+    double tileScale = 1.0; // Source pixels per model input pixel.
+    float minScore = 0.5f;
+    float nmsIou = 0.5f;
+};
+
+// Covers an image with tiles of the given size overlapping by at least the
+// given fraction. The last row and column of tiles are aligned with the image
+// edges; tiles are clamped to images smaller than a tile.
+std::vector<cv::Rect> makeTiles(cv::Size image, cv::Size tile, double overlap);
+
+// Runs detection on large images by splitting them into overlapping
+// model-sized tiles instead of shrinking the whole image to the model input,
+// so small objects survive.
+//
+// Tiles are views into the source image and are inferred in parallel on a
+// pool of CPU interpreters sharing one model. Each worker submits its tiles
+// asynchronously, so cutting and decoding overlap with inference. Detections
+// are mapped back to normalised image coordinates and duplicates from the
+// overlaps are merged with non-maximum suppression.
+class TiledDetector {
+  public:
+    TiledDetector();
+    ~TiledDetector();
+
+    void loadModel(const char *modelFile, size_t workers, int threadsPerWorker);
+    // The image is 8 bit BGR as returned by OpenCV.
+    std::vector<Detection> detect(const cv::Mat &image,
+                                  const TilingConfig &config);
+
+  private:
+    std::vector<std::unique_ptr<TfLite>> mInterpreters;
+    cv::Size mInputSize;
+};
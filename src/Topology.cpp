@@ -0,0 +1,404 @@
+#include "Topology.h"
+#include "utils.h"
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+string readSysFile(const string &path)
+{
+    ifstream file(path);
+    string content;
+    getline(file, content);
+    return content;
+}
+
+int readSysInt(const string &path, int fallback)
+{
+    string content = readSysFile(path);
+    return content.empty() ? fallback : stoi(content);
+}
+
+// Builds the node mask for the mbind/set_mempolicy syscalls.
+vector<unsigned long> nodeMask(int node)
+{
+    const size_t bits = 8 * sizeof(unsigned long);
+    vector<unsigned long> mask(node / bits + 1, 0);
+    mask[node / bits] |= 1UL << (node % bits);
+    return mask;
+}
+
+size_t hugePageSize()
+{
+    ifstream meminfo("/proc/meminfo");
+    string line;
+    size_t kb;
+    while (getline(meminfo, line))
+        if (sscanf(line.c_str(), "Hugepagesize: %zu kB", &kb) == 1)
+            return kb * 1024;
+    return 2 << 20;
+}
+
+// Faults every page of the range in, keeping its contents.
+void prefault(void *ptr, size_t bytes)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(ptr, bytes, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    volatile uint8_t *p = static_cast<volatile uint8_t *>(ptr);
+    const size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < bytes; i += page)
+        p[i] = p[i];
+}
+
+// Page-aligned ranges only. Explicit huge page mappings can't be advised.
+void applyPageOptions(void *ptr, size_t bytes, const PageOptions &options,
+                      bool transparent)
+{
+    if (transparent && madvise(ptr, bytes, MADV_HUGEPAGE) != 0)
+        cerr << "[WARNING]: Transparent huge pages are unavailable.\n";
+    if (options.prefault || options.lock)
+        prefault(ptr, bytes);
+    if (options.lock && mlock(ptr, bytes) != 0)
+        cerr << "[WARNING]: Couldn't lock " << bytes
+             << " bytes, check ulimit -l.\n";
+}
+
+} // namespace
+
+vector<int> parseCpuList(const string &list)
+{
+    vector<int> cpus;
+    stringstream ss(list);
+    string range;
+    while (getline(ss, range, ',')) {
+        if (range.empty())
+            continue;
+        size_t dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+string formatCpuList(const vector<int> &cpus)
+{
+    string list;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            ++j;
+        if (!list.empty())
+            list += ",";
+        list += to_string(cpus[i]);
+        if (j > i)
+            list += "-" + to_string(cpus[j]);
+        i = j + 1;
+    }
+    return list;
+}
+
+Topology Topology::detect()
+{
+    Topology topology;
+    const string cpuDir = "/sys/devices/system/cpu/";
+    const string nodeDir = "/sys/devices/system/node/";
+
+    vector<int> online = parseCpuList(readSysFile(cpuDir + "online"));
+    if (online.empty()) {
+        for (long i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); ++i)
+            online.push_back(static_cast<int>(i));
+    }
+
+    map<int, int> cpuToNode;
+    set<int> nodes;
+    for (int node : parseCpuList(readSysFile(nodeDir + "online"))) {
+        nodes.insert(node);
+        string cpulist =
+            readSysFile(nodeDir + "node" + to_string(node) + "/cpulist");
+        for (int cpu : parseCpuList(cpulist))
+            cpuToNode[cpu] = node;
+    }
+
+    for (int cpu : online) {
+        string dir = cpuDir + "cpu" + to_string(cpu) + "/topology/";
+        CpuInfo info;
+        info.cpu = cpu;
+        info.core = readSysInt(dir + "core_id", cpu);
+        info.socket = readSysInt(dir + "physical_package_id", 0);
+        info.node = cpuToNode.count(cpu) ? cpuToNode[cpu] : 0;
+        topology.mCpus.push_back(info);
+    }
+    topology.mNumNodes = max<int>(1, nodes.size());
+    return topology;
+}
+
+vector<int> Topology::cpusOfNode(int node) const
+{
+    vector<int> cpus;
+    for (const auto &info : mCpus)
+        if (info.node == node)
+            cpus.push_back(info.cpu);
+    return cpus;
+}
+
+int Topology::nodeOfCpu(int cpu) const
+{
+    for (const auto &info : mCpus)
+        if (info.cpu == cpu)
+            return info.node;
+    return -1;
+}
+
+void Topology::print() const
+{
+    set<int> sockets, cores;
+    for (const auto &info : mCpus) {
+        sockets.insert(info.socket);
+        cores.insert(info.socket * 100000 + info.core);
+    }
+
+    cout << "Topology: " << mCpus.size() << " cpus, " << cores.size()
+         << " cores, " << sockets.size() << " sockets, " << mNumNodes
+         << " NUMA nodes\n";
+    for (int node = 0; node < mNumNodes; ++node)
+        cout << "node " << node << " cpus: " << formatCpuList(cpusOfNode(node))
+             << "\n";
+}
+
+ThreadPlacement ThreadPlacement::fromString(const string &spec)
+{
+    ThreadPlacement placement;
+    stringstream ss(spec);
+    string entry;
+    while (ss >> entry) {
+        size_t eq = entry.find('=');
+        if (eq == string::npos)
+            errExit("Invalid thread placement entry: " + entry);
+        string key = entry.substr(0, eq);
+        string value = entry.substr(eq + 1);
+
+        if (key == "capture")
+            placement.capture = parseCpuList(value);
+        else if (key == "preprocess")
+            placement.preprocess = parseCpuList(value);
+        else if (key == "inference")
+            placement.inference = parseCpuList(value);
+        else if (key == "node")
+            placement.memoryNode = stoi(value);
+        else
+            errExit("Unknown thread placement key: " + key);
+    }
+    return placement;
+}
+
+ThreadPlacement ThreadPlacement::fromEnv()
+{
+    const char *spec = getenv("IZU_AFFINITY");
+    return spec ? fromString(spec) : ThreadPlacement();
+}
+
+vector<int> ThreadPlacement::captureAndPreprocess() const
+{
+    set<int> cpus(capture.begin(), capture.end());
+    cpus.insert(preprocess.begin(), preprocess.end());
+    return vector<int>(cpus.begin(), cpus.end());
+}
+
+vector<int> ThreadPlacement::inferenceCpusFor(size_t worker,
+                                              size_t workers) const
+{
+    if (inference.empty() || workers == 0)
+        return {};
+    if (inference.size() < workers)
+        return {inference[worker % inference.size()]};
+
+    size_t chunk = inference.size() / workers;
+    auto first = inference.begin() + worker * chunk;
+    return vector<int>(first, first + chunk);
+}
+
+void ThreadPlacement::print() const
+{
+    auto show = [](const vector<int> &cpus) {
+        return cpus.empty() ? string("any") : formatCpuList(cpus);
+    };
+    cout << "Thread placement: capture " << show(capture) << ", preprocess "
+         << show(preprocess) << ", inference " << show(inference)
+         << ", memory node "
+         << (memoryNode < 0 ? string("any") : to_string(memoryNode)) << "\n";
+}
+
+void pinCurrentThread(const vector<int> &cpus)
+{
+    if (cpus.empty())
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        cerr << "[WARNING]: Couldn't pin thread to cpus "
+             << formatCpuList(cpus) << "\n";
+}
+
+void preferMemoryNode(int node)
+{
+    if (node < 0)
+        return;
+
+    vector<unsigned long> mask = nodeMask(node);
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(),
+                mask.size() * 8 * sizeof(unsigned long) + 1) != 0)
+        cerr << "[WARNING]: Couldn't prefer memory node " << node << "\n";
+}
+
+PageOptions PageOptions::fromString(const string &spec)
+{
+    PageOptions options;
+    stringstream ss(spec);
+    string field;
+    while (getline(ss, field, ',')) {
+        if (field == "none")
+            options.hugePages = HugePages::None;
+        else if (field == "thp")
+            options.hugePages = HugePages::Transparent;
+        else if (field == "explicit")
+            options.hugePages = HugePages::Explicit;
+        else if (field == "prefault")
+            options.prefault = true;
+        else if (field == "lock")
+            options.lock = true;
+        else
+            errExit("Unknown page option: " + field);
+    }
+    return options;
+}
+
+void *allocOnNode(size_t bytes, int node)
+{
+    size_t mappedBytes;
+    return allocOnNode(bytes, node, PageOptions(), mappedBytes);
+}
+
+void *allocOnNode(size_t bytes, int node, const PageOptions &options,
+                  size_t &mappedBytes)
+{
+    using HugePages = PageOptions::HugePages;
+    const size_t huge =
+        options.hugePages == HugePages::None ? 0 : hugePageSize();
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    mappedBytes = huge ? (bytes + huge - 1) / huge * huge : bytes;
+
+    void *ptr = MAP_FAILED;
+    bool transparent = huge != 0;
+    if (options.hugePages == HugePages::Explicit) {
+        ptr = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE,
+                   flags | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED)
+            cerr << "[WARNING]: No huge pages reserved, using transparent "
+                    "ones.\n";
+        else
+            transparent = false;
+    }
+    if (ptr == MAP_FAILED && huge) {
+        // Transparent huge pages only back aligned ranges, so map an extra
+        // huge page and trim the ends.
+        void *raw = mmap(nullptr, mappedBytes + huge, PROT_READ | PROT_WRITE,
+                         flags, -1, 0);
+        if (raw == MAP_FAILED)
+            errExit("Couldn't allocate " + to_string(bytes) + " bytes.");
+        uintptr_t begin = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (begin + huge - 1) / huge * huge;
+        if (aligned > begin)
+            munmap(raw, aligned - begin);
+        munmap(reinterpret_cast<void *>(aligned + mappedBytes),
+               begin + huge - aligned);
+        ptr = reinterpret_cast<void *>(aligned);
+    }
+    else if (ptr == MAP_FAILED) {
+        ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr == MAP_FAILED)
+            errExit("Couldn't allocate " + to_string(bytes) + " bytes.");
+    }
+
+    // Bound before anything faults pages in.
+    if (node >= 0) {
+        vector<unsigned long> mask = nodeMask(node);
+        if (syscall(SYS_mbind, ptr, mappedBytes, MPOL_BIND, mask.data(),
+                    mask.size() * 8 * sizeof(unsigned long) + 1, 0) != 0)
+            cerr << "[WARNING]: Couldn't bind memory to node " << node
+                 << "\n";
+    }
+    if (!options.isDefault())
+        applyPageOptions(ptr, mappedBytes, options, transparent);
+    return ptr;
+}
+
+void freeOnNode(void *ptr, size_t bytes)
+{
+    if (ptr)
+        munmap(ptr, bytes);
+}
+
+void advisePages(void *ptr, size_t bytes, const PageOptions &options)
+{
+    if (options.isDefault())
+        return;
+
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + page - 1) / page;
+    uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + bytes) / page;
+    if (end <= begin)
+        return;
+    applyPageOptions(reinterpret_cast<void *>(begin * page),
+                     (end - begin) * page, options,
+                     options.hugePages != PageOptions::HugePages::None);
+}
+
+PageFaults PageFaults::now()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return {};
+    return {usage.ru_minflt, usage.ru_majflt};
+}
+
+ScopedAffinity::ScopedAffinity(const vector<int> &cpus)
+{
+    if (cpus.empty())
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set))
+                mPrevious.push_back(cpu);
+    }
+    pinCurrentThread(cpus);
+}
+
+ScopedAffinity::~ScopedAffinity() { pinCurrentThread(mPrevious); }
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct CpuInfo {
+    int cpu = 0;
+    int core = 0;
+    int socket = 0;
+    int node = 0;
+};
+
+// CPU and NUMA layout of the host, read from sysfs.
+class Topology {
+  public:
+    static Topology detect();
+
+    void print() const;
+    const std::vector<CpuInfo> &cpus() const { return mCpus; }
+    std::vector<int> cpusOfNode(int node) const;
+    int nodeOfCpu(int cpu) const;
+    int numNodes() const { return mNumNodes; }
+
+  private:
+    std::vector<CpuInfo> mCpus;
+    int mNumNodes = 1;
+};
+
+// Which CPUs the pipeline's threads may run on, and which NUMA node model
+// weights and buffers should be allocated on. Empty lists and a negative node
+// leave the OS defaults.
+//
+// Parsed from strings like "capture=0-1 preprocess=2 inference=4-7 node=0".
+struct ThreadPlacement {
+    std::vector<int> capture;
+    std::vector<int> preprocess;
+    std::vector<int> inference;
+    int memoryNode = -1;
+
+    static ThreadPlacement fromString(const std::string &spec);
+    // Reads the IZU_AFFINITY environment variable.
+    static ThreadPlacement fromEnv();
+
+    // CPUs for threads that both capture and preprocess frames: the union of
+    // both lists.
+    std::vector<int> captureAndPreprocess() const;
+    // Splits the inference CPUs into equal chunks, one per worker.
+    std::vector<int> inferenceCpusFor(size_t worker, size_t workers) const;
+    void print() const;
+};
+
+// Parses Linux cpulist syntax, e.g. "0-3,8,10-11".
+std::vector<int> parseCpuList(const std::string &list);
+std::string formatCpuList(const std::vector<int> &cpus);
+
+// Pins the calling thread to the CPUs. An empty list is a no-op. Threads
+// created afterwards inherit the mask, which is how TFLite's own worker
+// threads end up on the same CPUs as the thread that builds the interpreter.
+void pinCurrentThread(const std::vector<int> &cpus);
+
+// Makes the calling thread's future allocations prefer the NUMA node.
+void preferMemoryNode(int node);
+
+// How large, long-lived buffers like model weights and tensor arenas are
+// backed. Huge pages cut TLB misses, prefaulting moves first-touch page
+// faults from the first inferences to load time.
+struct PageOptions {
+    enum class HugePages { None, Transparent, Explicit };
+
+    // Explicit needs pages reserved in /proc/sys/vm/nr_hugepages and falls
+    // back to transparent ones without.
+    HugePages hugePages = HugePages::None;
+    bool prefault = false;
+    // Keeps the pages resident, within RLIMIT_MEMLOCK. Implies prefault.
+    bool lock = false;
+
+    bool isDefault() const
+    {
+        return hugePages == HugePages::None && !prefault && !lock;
+    }
+    // Parses a comma separated list of "none", "thp" or "explicit",
+    // "prefault" and "lock", e.g. "thp,lock".
+    static PageOptions fromString(const std::string &spec);
+};
+
+// Allocates page-aligned memory bound to a NUMA node (or anywhere for a
+// negative node). Free with freeOnNode().
+void *allocOnNode(size_t bytes, int node);
+// Same, backed as the options say. The size to free is returned in
+// mappedBytes, since huge pages round it up.
+void *allocOnNode(size_t bytes, int node, const PageOptions &options,
+                  size_t &mappedBytes);
+void freeOnNode(void *ptr, size_t bytes);
+// Applies the options to memory that is already allocated, e.g. by a
+// library. Only the whole pages inside the range are affected, explicit huge
+// pages become transparent ones, and prefaulting keeps the contents.
+void advisePages(void *ptr, size_t bytes, const PageOptions &options);
+
+// Page faults of the process so far, from getrusage().
+struct PageFaults {
+    long minor = 0;
+    long major = 0;
+
+    static PageFaults now();
+    PageFaults operator-(const PageFaults &other) const
+    {
+        return {minor - other.minor, major - other.major};
+    }
+};
+
+// Pins the calling thread for its lifetime and restores the previous mask.
+class ScopedAffinity {
+  public:
+    ScopedAffinity(const std::vector<int> &cpus);
+    ~ScopedAffinity();
+
+  private:
+    std::vector<int> mPrevious;
+};
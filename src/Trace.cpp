@@ -0,0 +1,183 @@
+#include "Trace.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Event {
+    uint64_t ns; // Since the trace started.
+    const char *name;
+    char phase; // 'B'egin or 'E'nd.
+};
+
+// Events are stored in chunks that are allocated by the owning thread as it
+// goes and never move, so the flush can read them while the thread records.
+constexpr size_t CHUNK_EVENTS = 1 << 14;
+constexpr size_t MAX_CHUNKS = 256;
+
+struct ThreadBuffer {
+    int tid = 0;
+    atomic<const char *> name{nullptr};
+    atomic<Event *> chunks[MAX_CHUNKS] = {};
+    atomic<size_t> count{0}; // Published events.
+    atomic<size_t> dropped{0};
+};
+
+struct TraceState {
+    string file;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    mutex guard; // Registration, interning and flushing.
+    vector<unique_ptr<ThreadBuffer>> buffers; // Outlive their threads.
+    set<string> names;
+};
+
+// Never destroyed, so threads and atexit handlers can still use it during
+// static destruction.
+TraceState &state()
+{
+    static TraceState *s = [] {
+        auto *state = new TraceState;
+        state->file = getenv("IZU_TRACE");
+        atexit(traceFlush);
+        return state;
+    }();
+    return *s;
+}
+
+thread_local ThreadBuffer *threadBuffer = nullptr;
+
+ThreadBuffer &buffer()
+{
+    if (!threadBuffer) {
+        TraceState &s = state();
+        lock_guard<mutex> lock(s.guard);
+        s.buffers.push_back(make_unique<ThreadBuffer>());
+        threadBuffer = s.buffers.back().get();
+        threadBuffer->tid = s.buffers.size();
+    }
+    return *threadBuffer;
+}
+
+void record(const char *name, char phase)
+{
+    uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(
+                      chrono::steady_clock::now() - state().start)
+                      .count();
+
+    ThreadBuffer &b = buffer();
+    size_t i = b.count.load(memory_order_relaxed);
+    size_t chunk = i / CHUNK_EVENTS;
+    if (chunk >= MAX_CHUNKS) {
+        b.dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    Event *events = b.chunks[chunk].load(memory_order_relaxed);
+    if (!events) {
+        events = new Event[CHUNK_EVENTS];
+        b.chunks[chunk].store(events, memory_order_release);
+    }
+    events[i % CHUNK_EVENTS] = {ns, name, phase};
+    b.count.store(i + 1, memory_order_release);
+}
+
+void writeString(ostream &out, const char *s)
+{
+    out << '"';
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            out << '\\';
+        if (static_cast<unsigned char>(*s) >= 0x20)
+            out << *s;
+    }
+    out << '"';
+}
+
+} // namespace
+
+bool traceEnabled()
+{
+    static const bool enabled = getenv("IZU_TRACE") != nullptr;
+    return enabled;
+}
+
+void traceBegin(const char *name) { record(name, 'B'); }
+
+void traceEnd(const char *name) { record(name, 'E'); }
+
+const char *traceIntern(const string &name)
+{
+    TraceState &s = state();
+    lock_guard<mutex> lock(s.guard);
+    return s.names.insert(name).first->c_str();
+}
+
+void traceThreadName(const char *name)
+{
+    if (traceEnabled())
+        buffer().name.store(name, memory_order_relaxed);
+}
+
+void traceFlush()
+{
+    if (!traceEnabled())
+        return;
+
+    TraceState &s = state();
+    lock_guard<mutex> lock(s.guard);
+    ofstream out(s.file);
+    if (!out) {
+        cerr << "[WARNING]: Couldn't write trace " << s.file << "\n";
+        return;
+    }
+
+    const int pid = getpid();
+    size_t written = 0, dropped = 0;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto &b : s.buffers) {
+        if (const char *name = b->name.load(memory_order_relaxed)) {
+            out << (first ? "" : ",\n")
+                << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid
+                << ",\"tid\":" << b->tid << ",\"args\":{\"name\":";
+            writeString(out, name);
+            out << "}}";
+            first = false;
+        }
+
+        size_t count = b->count.load(memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            const Event *events =
+                b->chunks[i / CHUNK_EVENTS].load(memory_order_acquire);
+            const Event &e = events[i % CHUNK_EVENTS];
+            char ts[32];
+            snprintf(ts, sizeof(ts), "%.3f", e.ns / 1000.0);
+            out << (first ? "" : ",\n") << "{\"ph\":\"" << e.phase
+                << "\",\"name\":";
+            writeString(out, e.name);
+            out << ",\"pid\":" << pid << ",\"tid\":" << b->tid
+                << ",\"ts\":" << ts << "}";
+            first = false;
+        }
+        written += count;
+        dropped += b->dropped.load(memory_order_relaxed);
+    }
+    out << "\n]}\n";
+
+    cerr << "Wrote " << written << " trace events to " << s.file;
+    if (dropped)
+        cerr << ", dropped " << dropped << " that didn't fit";
+    cerr << "\n";
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+
+// Timeline tracing in the Chrome trace event format, for chrome://tracing or
+// ui.perfetto.dev.
+//
+// Enabled by pointing the IZU_TRACE environment variable at the output file.
+// Every thread records begin/end events into its own buffer without locking;
+// the buffers are written out at exit or by traceFlush(). While tracing,
+// TIMER scopes become trace events instead of printing their durations.
+bool traceEnabled();
+// Names must stay valid until the trace is flushed, e.g. string literals or
+// names returned by traceIntern().
+void traceBegin(const char *name);
+void traceEnd(const char *name);
+// Copies a dynamic name into storage that lives as long as the trace.
+const char *traceIntern(const std::string &name);
+// Labels the calling thread in the trace viewer.
+void traceThreadName(const char *name);
+void traceFlush();
+
+// Traces the enclosing scope without printing anything.
+class TraceScope {
+  public:
+    TraceScope(const char *name) : mName(name)
+    {
+        if (traceEnabled())
+            traceBegin(mName);
+    }
+    ~TraceScope()
+    {
+        if (traceEnabled())
+            traceEnd(mName);
+    }
+
+  private:
+    const char *mName;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name);
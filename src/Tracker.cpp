@@ -0,0 +1,74 @@
+#include "Tracker.h"
+
+#include <algorithm>
+#include <tuple>
+
+using namespace std;
+
+namespace {
+
+BoundingBox blend(const BoundingBox &old, const BoundingBox &now, float weight)
+{
+    auto mix = [weight](float a, float b) {
+        return weight * a + (1 - weight) * b;
+    };
+    return {mix(old.top, now.top), mix(old.left, now.left),
+            mix(old.bottom, now.bottom), mix(old.right, now.right)};
+}
+
+} // namespace
+
+IouTracker::IouTracker() : IouTracker(Config()) {}
+
+IouTracker::IouTracker(const Config &config) : mConfig(config) {}
+
+void IouTracker::update(Detections &detections)
+{
+    for (size_t d = 0; d < detections.count; ++d)
+        detections.trackIds[d] = -1;
+
+    // Candidate pairs as (iou, track, detection), best overlap first.
+    vector<tuple<float, size_t, size_t>> pairs;
+    for (size_t t = 0; t < mTracks.size(); ++t) {
+        for (size_t d = 0; d < detections.count; ++d) {
+            if (detections.scores[d] < mConfig.minScore ||
+                detections.classes[d] != mTracks[t].classId)
+                continue;
+            float overlap = iou(mTracks[t].box, detections.boxes[d]);
+            if (overlap >= mConfig.minIou)
+                pairs.emplace_back(overlap, t, d);
+        }
+    }
+    sort(pairs.begin(), pairs.end(),
+         [](const auto &a, const auto &b) { return get<0>(a) > get<0>(b); });
+
+    vector<bool> trackMatched(mTracks.size(), false);
+    for (const auto &[overlap, t, d] : pairs) {
+        if (trackMatched[t] || detections.trackIds[d] >= 0)
+            continue;
+        trackMatched[t] = true;
+        Track &track = mTracks[t];
+        track.box = blend(track.box, detections.boxes[d], mConfig.smoothing);
+        track.misses = 0;
+        detections.boxes[d] = track.box;
+        detections.trackIds[d] = track.id;
+    }
+
+    for (size_t t = 0; t < mTracks.size(); ++t)
+        if (!trackMatched[t])
+            ++mTracks[t].misses;
+    mTracks.erase(remove_if(mTracks.begin(), mTracks.end(),
+                            [this](const Track &track) {
+                                return track.misses > mConfig.maxMisses;
+                            }),
+                  mTracks.end());
+
+    for (size_t d = 0; d < detections.count; ++d) {
+        if (detections.trackIds[d] >= 0 ||
+            detections.scores[d] < mConfig.minScore)
+            continue;
+        detections.trackIds[d] = mNextId;
+        mTracks.push_back({mNextId++, detections.classes[d],
+                           detections.boxes[d]});
+    }
+}
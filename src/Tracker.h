@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Detections.h"
+
+#include <vector>
+
+// Gives detections IDs that persist across frames by greedily matching them
+// to the tracks of earlier frames by IoU, within the same class.
+//
+// Tracks survive a few frames without a match and their boxes are smoothed,
+// so IDs and boxes stay continuous across missed detections and when the
+// detector switches between model variants whose boxes differ slightly.
+class IouTracker {
+  public:
+    struct Config {
+        float minIou = 0.3f; // Least overlap to continue a track.
+        int maxMisses = 5;   // Frames a track survives without a match.
+        float smoothing = 0.5f; // Weight of the old box, 0 disables.
+        float minScore = 0.5f;  // Weaker detections are left untracked.
+    };
+
+    IouTracker();
+    IouTracker(const Config &config);
+
+    // Sets trackIds, and smooths boxes of continued tracks.
+    void update(Detections &detections);
+
+  private:
+    struct Track {
+        int id;
+        int classId;
+        BoundingBox box;
+        int misses = 0;
+    };
+
+    const Config mConfig;
+    std::vector<Track> mTracks;
+    int mNextId = 0;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer/single-consumer triple buffer.
+//
+// The writer fills writeBuffer() and calls publish(); the reader calls read()
+// and always gets the latest complete value without waiting for the writer.
+// Values that are published but never read are simply overwritten.
+template <class T> class TripleBuffer {
+  public:
+    T &writeBuffer() { return mBuffers[mWrite]; }
+
+    void publish()
+    {
+        uint8_t prev =
+            mShared.exchange(mWrite | DIRTY, std::memory_order_acq_rel);
+        mWrite = prev & INDEX;
+    }
+
+    // Returns the latest published value, or the previous one if nothing new
+    // has been published since the last call.
+    const T &read()
+    {
+        if (mShared.load(std::memory_order_relaxed) & DIRTY) {
+            uint8_t prev = mShared.exchange(mRead, std::memory_order_acq_rel);
+            mRead = prev & INDEX;
+        }
+        return mBuffers[mRead];
+    }
+
+    bool hasNew() const
+    {
+        return mShared.load(std::memory_order_relaxed) & DIRTY;
+    }
+
+  private:
+    constexpr static uint8_t INDEX = 0x3;
+    constexpr static uint8_t DIRTY = 0x4;
+
+    T mBuffers[3]{};
+    uint8_t mWrite = 0;
+    // Keep the shared index away from the writer's and reader's lines.
+    alignas(64) std::atomic<uint8_t> mShared{1};
+    alignas(64) uint8_t mRead = 2;
+};
@@ -0,0 +1,98 @@
+#include "TypedSession.h"
+
+using namespace std;
+
+namespace {
+
+string typeName(TfLiteType type)
+{
+    switch (type) {
+    case kTfLiteFloat32:
+        return "float32";
+    case kTfLiteUInt8:
+        return "uint8";
+    case kTfLiteInt8:
+        return "int8";
+    default:
+        return "type " + to_string(type);
+    }
+}
+
+template <class InputT, class OutputT>
+unique_ptr<Session> makeWithLayout(tflite::Interpreter &interpreter,
+                                   int channels)
+{
+    switch (channels) {
+    case 1:
+        return make_unique<TypedSession<InputT, OutputT, Layout::Gray>>(
+            interpreter);
+    case 3:
+        return make_unique<TypedSession<InputT, OutputT, Layout::Rgb>>(
+            interpreter);
+    case 4:
+        return make_unique<TypedSession<InputT, OutputT, Layout::Rgba>>(
+            interpreter);
+    default:
+        return nullptr;
+    }
+}
+
+template <class InputT>
+unique_ptr<Session> makeWithOutput(tflite::Interpreter &interpreter,
+                                   TfLiteType output, int channels)
+{
+    switch (output) {
+    case kTfLiteFloat32:
+        return makeWithLayout<InputT, float>(interpreter, channels);
+    case kTfLiteUInt8:
+        return makeWithLayout<InputT, uint8_t>(interpreter, channels);
+    case kTfLiteInt8:
+        return makeWithLayout<InputT, int8_t>(interpreter, channels);
+    default:
+        return nullptr;
+    }
+}
+
+} // namespace
+
+string imageModelError(const tflite::Interpreter &interpreter)
+{
+    const TfLiteTensor *input = interpreter.tensor(interpreter.inputs()[0]);
+    const TfLiteTensor *output = interpreter.tensor(interpreter.outputs()[0]);
+    if (input->dims->size != 4)
+        return "Expected an NHWC image input, the model's input has " +
+               to_string(input->dims->size) + " dimensions.";
+
+    auto supported = [](TfLiteType type) {
+        return type == kTfLiteFloat32 || type == kTfLiteUInt8 ||
+               type == kTfLiteInt8;
+    };
+    int channels = input->dims->data[3];
+    if (!supported(input->type) || !supported(output->type) ||
+        (channels != 1 && channels != 3 && channels != 4))
+        return "Unsupported model: " + typeName(input->type) + " input with " +
+               to_string(channels) + " channels and " +
+               typeName(output->type) +
+               " output. Inputs must be float32, uint8 or int8 with 1, 3 or "
+               "4 channels, outputs float32, uint8 or int8.";
+    return "";
+}
+
+unique_ptr<Session> makeSession(tflite::Interpreter &interpreter)
+{
+    string error = imageModelError(interpreter);
+    if (!error.empty())
+        errExit(error);
+
+    const TfLiteTensor *input = interpreter.tensor(interpreter.inputs()[0]);
+    const TfLiteTensor *output = interpreter.tensor(interpreter.outputs()[0]);
+    int channels = input->dims->data[3];
+    switch (input->type) {
+    case kTfLiteFloat32:
+        return makeWithOutput<float>(interpreter, output->type, channels);
+    case kTfLiteUInt8:
+        return makeWithOutput<uint8_t>(interpreter, output->type, channels);
+    default:
+        return makeWithOutput<int8_t>(interpreter, output->type, channels);
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "utils.h"
+
+#include "tensorflow/lite/interpreter.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Channel layout of an image model's NHWC input.
+enum class Layout { Gray = 1, Rgb = 3, Rgba = 4 };
+
+// Image classification pipeline of one model: preprocessing into the input
+// tensor and reading top results from the output.
+//
+// The implementation is picked once, on the model's first image, from its
+// input type, output type and channel count. Image programs check the model
+// with imageModelError() when it is loaded, so picking can't fail there. The
+// virtual call per image is the only dispatch left; the kernels behind it are
+// instantiated for the exact types and layout, so their loops don't branch
+// on them.
+class Session {
+  public:
+    virtual ~Session() = default;
+
+    // Converts decoded RGB(A) or gray image data to the model's layout and
+    // resizes it into the input tensor. The tensors must be allocated.
+    virtual void loadImage(const uint8_t *image, int width, int height,
+                           int channels) = 0;
+    // Top classification results of the first output, best first.
+    virtual std::vector<std::pair<float, int>>
+    topResults(size_t results, float threshold) const = 0;
+};
+
+// Empty if there are kernels for the interpreter's first input and output,
+// otherwise why there aren't.
+std::string imageModelError(const tflite::Interpreter &interpreter);
+// Picks the session for the interpreter's first input and output. Exits on
+// combinations imageModelError() rejects. The interpreter must outlive the
+// session.
+std::unique_ptr<Session> makeSession(tflite::Interpreter &interpreter);
+
+// InputT and OutputT are float, uint8_t or int8_t.
+template <class InputT, class OutputT, Layout L>
+class TypedSession : public Session {
+  public:
+    constexpr static int CHANNELS = static_cast<int>(L);
+
+    TypedSession(tflite::Interpreter &interpreter)
+        : mInterpreter(interpreter),
+          mOutputQuant(interpreter.tensor(interpreter.outputs()[0])->params)
+    {
+    }
+
+    void loadImage(const uint8_t *image, int width, int height,
+                   int channels) override
+    {
+        // One branch per image picks the repacking kernel.
+        const size_t pixels = size_t(width) * height;
+        const uint8_t *packed = image;
+        if (channels != CHANNELS) {
+            switch (channels) {
+            case 1:
+                packed = repack<1>(image, pixels);
+                break;
+            case 3:
+                packed = repack<3>(image, pixels);
+                break;
+            case 4:
+                packed = repack<4>(image, pixels);
+                break;
+            default:
+                errExit("Unexpected number of channels: " +
+                        std::to_string(channels));
+            }
+        }
+
+        // Pixels go in as they are, or shifted by -128 for int8. Both are the
+        // same real values for a given scale, since int8 quantisation is the
+        // uint8 one with the zero point shifted by 128.
+        int input = mInterpreter.inputs()[0];
+        const TfLiteIntArray *dims = mInterpreter.tensor(input)->dims;
+        resize<InputT>(mInterpreter.typed_tensor<InputT>(input),
+                       const_cast<uint8_t *>(packed), height, width, CHANNELS,
+                       dims->data[1], dims->data[2], CHANNELS);
+    }
+
+    std::vector<std::pair<float, int>>
+    topResults(size_t results, float threshold) const override
+    {
+        int output = mInterpreter.outputs()[0];
+        const TfLiteIntArray *dims = mInterpreter.tensor(output)->dims;
+        // Assume output dims to be something like (1, 1, ... ,size).
+        std::vector<std::pair<float, int>> top;
+        get_top_n<OutputT>(mInterpreter.typed_output_tensor<OutputT>(0),
+                           dims->data[dims->size - 1], results, threshold,
+                           &top, mOutputQuant);
+        return top;
+    }
+
+  private:
+    // Converts From channels per pixel to CHANNELS. Gray is the luma of
+    // colour images and is copied to every colour channel; added alpha is
+    // opaque.
+    template <int From>
+    const uint8_t *repack(const uint8_t *image, size_t pixels)
+    {
+        mPacked.resize(pixels * CHANNELS);
+        uint8_t *out = mPacked.data();
+        for (size_t p = 0; p < pixels; ++p, image += From, out += CHANNELS) {
+            if constexpr (CHANNELS == 1 && From >= 3) {
+                out[0] = uint8_t(
+                    (77 * image[0] + 150 * image[1] + 29 * image[2]) >> 8);
+            }
+            else if constexpr (From == 1) {
+                for (int c = 0; c < CHANNELS && c < 3; ++c)
+                    out[c] = image[0];
+                if constexpr (CHANNELS == 4)
+                    out[3] = 255;
+            }
+            else {
+                for (int c = 0; c < 3; ++c)
+                    out[c] = image[c];
+                if constexpr (CHANNELS == 4)
+                    out[3] = From == 4 ? image[3] : 255;
+            }
+        }
+        return mPacked.data();
+    }
+
+    tflite::Interpreter &mInterpreter;
+    const TfLiteQuantizationParams mOutputQuant;
+    std::vector<uint8_t> mPacked;
+};
@@ -1,6 +1,7 @@
 #include "bmp.h"
 #include "utils.h"
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -50,6 +51,9 @@ class BMP {
     ~BMP();
 
     void read(const char *file);
+    // Parses the headers of a BMP file in memory, without copying the pixel
+    // data. Returns the offset of the pixel data.
+    size_t readHeaders(const uint8_t *data, size_t bytes);
     void write(const char *file) const;
     void printInfo() const;
     void addData(size_t width, size_t height, const vector<uint8_t> &data);
@@ -95,16 +99,34 @@ int BMP::getChannels() const { return static_cast<int>(mDibHeader.bpp) / 8; }
 
 void BMP::readHeaders(ifstream &inp)
 {
-    inp.read(reinterpret_cast<char *>(&mFileHeader), HEADER_SIZE);
+    uint8_t headers[HEADER_SIZE + DIB_HEADER_SIZE + COLOR_HEADER_SIZE];
+    inp.read(reinterpret_cast<char *>(headers), sizeof(headers));
+    readHeaders(headers, inp.gcount());
+    inp.clear();
+}
+
+size_t BMP::readHeaders(const uint8_t *data, size_t bytes)
+{
+    if (bytes < HEADER_SIZE + DIB_HEADER_SIZE)
+        errExit("BMP data is truncated.");
+
+    // BMPHeader is padded, so it's read field by field.
+    memcpy(&mFileHeader.file_type, data, 2);
+    memcpy(&mFileHeader.file_size, data + 2, 4);
+    memcpy(&mFileHeader.reserved1, data + 6, 2);
+    memcpy(&mFileHeader.reserved2, data + 8, 2);
+    memcpy(&mFileHeader.offset_data, data + 10, 4);
     if (mFileHeader.file_type != 0x4D42)
         errExit("File type error when reading BMP.");
 
-    inp.read(reinterpret_cast<char *>(&mDibHeader), DIB_HEADER_SIZE);
+    memcpy(&mDibHeader, data + HEADER_SIZE, DIB_HEADER_SIZE);
 
     // Color header
     if (mDibHeader.bpp == 32) {
-        if (mDibHeader.size >= (DIB_HEADER_SIZE + COLOR_HEADER_SIZE)) {
-            inp.read((char *)&mColorHeader, COLOR_HEADER_SIZE);
+        if (mDibHeader.size >= (DIB_HEADER_SIZE + COLOR_HEADER_SIZE) &&
+            bytes >= HEADER_SIZE + DIB_HEADER_SIZE + COLOR_HEADER_SIZE) {
+            memcpy(&mColorHeader, data + HEADER_SIZE + DIB_HEADER_SIZE,
+                   COLOR_HEADER_SIZE);
             checkColorHeaderFormat(mColorHeader);
         }
         else {
@@ -113,6 +135,7 @@ void BMP::readHeaders(ifstream &inp)
             errExit("Unrecognized file format.");
         }
     }
+    return HEADER_SIZE + mDibHeader.size;
 }
 
 void BMP::read(const char *file)
@@ -180,13 +203,13 @@ void BMP::convertTo4Channels()
 {
     if (mDibHeader.bpp == 24) // Transform data to 32bit BGRA format.
     {
-        vector<uint8_t> newData;
-        size_t pixels = mDibHeader.width * mDibHeader.height * 3;
-        for (size_t i = 0; i < pixels; i += 3) {
-            newData.push_back(mData[i]);
-            newData.push_back(mData[i + 1]);
-            newData.push_back(mData[i + 2]);
-            newData.push_back(255);
+        size_t pixels = mDibHeader.width * mDibHeader.height;
+        vector<uint8_t> newData(pixels * 4);
+        for (size_t i = 0; i < pixels; ++i) {
+            newData[4 * i] = mData[3 * i];
+            newData[4 * i + 1] = mData[3 * i + 1];
+            newData[4 * i + 2] = mData[3 * i + 2];
+            newData[4 * i + 3] = 255;
         }
         addData(mDibHeader.width, mDibHeader.height, newData);
     }
@@ -252,6 +275,19 @@ void BMP::printInfo() const
     }
 }
 
+// Converts packed RGB pixels to the BGRA layout that BMP::write expects.
+static vector<uint8_t> rgbToBgra(const uint8_t *data, size_t pixels)
+{
+    vector<uint8_t> bgra(pixels * 4);
+    for (size_t i = 0; i < pixels; ++i) {
+        bgra[4 * i] = data[3 * i + 2];
+        bgra[4 * i + 1] = data[3 * i + 1];
+        bgra[4 * i + 2] = data[3 * i];
+        bgra[4 * i + 3] = 255;
+    }
+    return bgra;
+}
+
 void writeBmp(size_t width, size_t height, size_t channels,
               const std::vector<uint8_t> &data, const char *fileName)
 {
@@ -262,15 +298,7 @@ void writeBmp(size_t width, size_t height, size_t channels,
         image.addData(width, height, data);
     }
     else if (channels == 3) {
-        vector<uint8_t> newData;
-        size_t pixels = width * height * channels;
-        for (size_t i = 0; i < pixels; i += 3) {
-            newData.push_back(data[i + 2]);
-            newData.push_back(data[i + 1]);
-            newData.push_back(data[i]);
-            newData.push_back(255);
-        }
-        image.addData(width, height, newData);
+        image.addData(width, height, rgbToBgra(data.data(), width * height));
     }
     else {
         errExit("Invalid channels argument for creating bmp.");
@@ -290,14 +318,7 @@ void writeBmp(size_t width, size_t height, size_t channels, uint8_t *data,
         image.addData(width, height, data, pixels);
     }
     else if (channels == 3) {
-        vector<uint8_t> newData;
-        for (size_t i = 0; i < pixels; i += 3) {
-            newData.push_back(data[i + 2]);
-            newData.push_back(data[i + 1]);
-            newData.push_back(data[i]);
-            newData.push_back(255);
-        }
-        image.addData(width, height, newData);
+        image.addData(width, height, rgbToBgra(data, width * height));
     }
     else {
         errExit("Invalid channels argument for creating bmp.");
@@ -372,3 +393,26 @@ std::vector<uint8_t> readBmp(const char *fileName, int *width, int *height,
     return decodeBmpData(image.getData().data(), image.getWidth(),
                          image.getHeight(), image.getChannels());
 }
+
+std::vector<uint8_t> decodeBmp(const uint8_t *file, size_t bytes, int *width,
+                               int *height, int *channels)
+{
+    BMP image;
+    size_t offset = image.readHeaders(file, bytes);
+    if (image.getHeight() < 0)
+        errExit("The program can treat only BMP images with the "
+                "origin in the bottom left corner!");
+
+    size_t rowSize = (8 * image.getChannels() * image.getWidth() + 31) / 32 * 4;
+    if (offset > bytes || bytes - offset < rowSize * image.getHeight())
+        errExit("BMP data is truncated.");
+
+    if (width)
+        *width = image.getWidth();
+    if (height)
+        *height = image.getHeight();
+    if (channels)
+        *channels = image.getChannels();
+    return decodeBmpData(file + offset, image.getWidth(), image.getHeight(),
+                         image.getChannels());
+}
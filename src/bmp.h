@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <vector>
 
@@ -22,4 +23,8 @@ std::vector<uint8_t> decodeBmpData(const uint8_t *input, int width, int height,
 
 // Returns a RGB(A) data vector containing the BMP file data.
 std::vector<uint8_t> readBmp(const char *fileName, int *width, int *height,
-                             int *channels);
\ No newline at end of file
+                             int *channels);
+
+// Same for a whole BMP file already in memory, e.g. from an ImageReader.
+std::vector<uint8_t> decodeBmp(const uint8_t *file, size_t bytes, int *width,
+                               int *height, int *channels);
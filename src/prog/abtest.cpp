@@ -0,0 +1,241 @@
+// Runs the same images through several model/backend configurations and
+// compares their latency and how far their outputs drift from the first
+// (reference) configuration.
+//
+// usage: abtest [-r runs] [-t threads] [-d] -c <name>=<model>,<backend>[,fp16]
+//               [-c ...] <image.bmp> ...
+//
+// backend is cpu, gpu or xnnpack; fp16 allows reduced precision. -d compares
+// SSD detection outputs instead of classification scores.
+//
+// Ex: abtest -c float=res/m.tflite,cpu -c int8=res/m_quant.tflite,cpu
+//            -c gpu16=res/m.tflite,gpu,fp16 res/img/*.bmp
+#include "Detections.h"
+#include "TfLite.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <unistd.h>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Config {
+    string name;
+    string model;
+    TfLite::Backend backend = TfLite::Backend::Cpu;
+    bool reducedPrecision = false;
+};
+
+// Outputs and latencies of one configuration over the whole image set.
+struct RunResult {
+    vector<double> latenciesMs;
+    vector<vector<pair<float, int>>> topResults;
+    vector<Detections> detections;
+};
+
+Config parseConfig(const string &arg)
+{
+    size_t eq = arg.find('=');
+    if (eq == string::npos)
+        errExit("Invalid config " + arg + ", expected name=model,backend");
+
+    Config config;
+    config.name = arg.substr(0, eq);
+    vector<string> fields;
+    string rest = arg.substr(eq + 1);
+    size_t pos;
+    while ((pos = rest.find(',')) != string::npos) {
+        fields.push_back(rest.substr(0, pos));
+        rest = rest.substr(pos + 1);
+    }
+    fields.push_back(rest);
+
+    config.model = fields[0];
+    if (fields.size() > 1)
+        config.backend = parseBackend(fields[1]);
+    if (fields.size() > 2)
+        config.reducedPrecision = fields[2] == "fp16";
+    return config;
+}
+
+RunResult runConfig(const Config &config, const vector<string> &images,
+                    size_t runs, int threads, bool detection)
+{
+    TfLite tfLite;
+    tfLite.setBackend(config.backend);
+    tfLite.setPrecisionLossAllowed(config.reducedPrecision);
+    tfLite.setNumThreads(threads);
+    tfLite.loadModel(config.model.c_str());
+    string error;
+    if (!tfLite.isImageModel(&error))
+        errExit(config.name + ": " + error);
+
+    RunResult result;
+    for (const auto &image : images) {
+        tfLite.loadBmpImage(image.c_str());
+        // Warm up caches and lazily created kernels before measuring.
+        tfLite.invoke();
+
+        for (size_t r = 0; r < runs; ++r) {
+            auto start = Clock::now();
+            tfLite.invoke();
+            chrono::duration<double, milli> elapsed = Clock::now() - start;
+            result.latenciesMs.push_back(elapsed.count());
+        }
+
+        if (detection)
+            result.detections.push_back(
+                decodeDetections(tfLite.copyOutputs()));
+        else
+            result.topResults.push_back(tfLite.getTopResults(5, 0.f));
+    }
+    return result;
+}
+
+double percentile(vector<double> sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    sort(sorted.begin(), sorted.end());
+    size_t idx = min(sorted.size() - 1,
+                     static_cast<size_t>(p / 100.0 * sorted.size()));
+    return sorted[idx];
+}
+
+void printClassificationDivergence(const RunResult &ref, const RunResult &run)
+{
+    size_t top1 = 0;
+    double top5 = 0.0;
+    size_t n = min(ref.topResults.size(), run.topResults.size());
+    for (size_t i = 0; i < n; ++i) {
+        const auto &a = ref.topResults[i];
+        const auto &b = run.topResults[i];
+        if (a.empty() || b.empty())
+            continue;
+        if (a[0].second == b[0].second)
+            ++top1;
+
+        set<int> classes;
+        for (const auto &r : a)
+            classes.insert(r.second);
+        size_t common = count_if(b.begin(), b.end(), [&](const auto &r) {
+            return classes.count(r.second) > 0;
+        });
+        top5 += static_cast<double>(common) / max(a.size(), b.size());
+    }
+    cout << setw(9) << (n ? 100.0 * top1 / n : 0.0) << setw(9)
+         << (n ? 100.0 * top5 / n : 0.0);
+}
+
+void printDetectionDivergence(const RunResult &ref, const RunResult &run)
+{
+    const float MIN_SCORE = 0.5f;
+    const float MIN_IOU = 0.5f;
+
+    size_t references = 0, matched = 0;
+    double iouSum = 0.0, scoreDeltaSum = 0.0;
+    size_t n = min(ref.detections.size(), run.detections.size());
+    for (size_t i = 0; i < n; ++i) {
+        const Detections &a = ref.detections[i];
+        const Detections &b = run.detections[i];
+        for (size_t j = 0; j < a.count; ++j) {
+            if (a.scores[j] < MIN_SCORE)
+                continue;
+            ++references;
+
+            float bestIou = 0.f;
+            size_t best = 0;
+            for (size_t k = 0; k < b.count; ++k) {
+                if (b.classes[k] != a.classes[j])
+                    continue;
+                float overlap = iou(a.boxes[j], b.boxes[k]);
+                if (overlap > bestIou) {
+                    bestIou = overlap;
+                    best = k;
+                }
+            }
+            if (bestIou >= MIN_IOU) {
+                ++matched;
+                iouSum += bestIou;
+                scoreDeltaSum += abs(a.scores[j] - b.scores[best]);
+            }
+        }
+    }
+    cout << setw(9) << (references ? 100.0 * matched / references : 0.0)
+         << setw(9) << (matched ? iouSum / matched : 0.0) << setw(9)
+         << (matched ? scoreDeltaSum / matched : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t runs = 10;
+    int threads = 4;
+    bool detection = false;
+    vector<Config> configs;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:dc:")) != -1) {
+        switch (opt) {
+        case 'r':
+            runs = stoul(optarg);
+            break;
+        case 't':
+            threads = stoi(optarg);
+            break;
+        case 'd':
+            detection = true;
+            break;
+        case 'c':
+            configs.push_back(parseConfig(optarg));
+            break;
+        default:
+            errExit("usage: abtest [-r runs] [-t threads] [-d] "
+                    "-c <name>=<model>,<backend>[,fp16] ... <image.bmp> ...");
+        }
+    }
+    vector<string> images(argv + optind, argv + argc);
+    if (configs.empty() || images.empty())
+        errExit("usage: abtest [options] -c <config> ... <image.bmp> ...");
+
+    vector<RunResult> results;
+    for (const auto &config : configs)
+        results.push_back(runConfig(config, images, runs, threads, detection));
+
+    cout << "\n" << images.size() << " images x " << runs
+         << " runs, divergence against " << configs[0].name << "\n";
+    cout << left << setw(16) << "config" << right << setw(9) << "backend"
+         << setw(9) << "mean ms" << setw(9) << "p50" << setw(9) << "p90"
+         << setw(9) << "p99" << setw(9) << "max";
+    if (detection)
+        cout << setw(9) << "match %" << setw(9) << "IoU" << setw(9)
+             << "|dscore|";
+    else
+        cout << setw(9) << "top1 %" << setw(9) << "top5 %";
+    cout << "\n" << fixed << setprecision(2);
+
+    for (size_t i = 0; i < configs.size(); ++i) {
+        const vector<double> &lat = results[i].latenciesMs;
+        double mean = 0.0;
+        for (double l : lat)
+            mean += l;
+        mean /= max<size_t>(1, lat.size());
+
+        string backend = backendName(configs[i].backend) +
+                         (configs[i].reducedPrecision ? "16" : "");
+        cout << left << setw(16) << configs[i].name << right << setw(9)
+             << backend << setw(9) << mean << setw(9) << percentile(lat, 50)
+             << setw(9) << percentile(lat, 90) << setw(9)
+             << percentile(lat, 99) << setw(9) << percentile(lat, 100);
+        if (detection)
+            printDetectionDivergence(results[0], results[i]);
+        else
+            printClassificationDivergence(results[0], results[i]);
+        cout << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,360 @@
+// Open-loop load generator: fires frames at a pool of interpreters at a set
+// arrival rate, whether or not earlier frames have finished, and reports
+// throughput and latency percentiles per rate. Latency is measured from the
+// scheduled arrival, so it includes queueing and the knee where the pool
+// saturates shows up in the tail.
+//
+// usage: loadgen [-w workers] [-t threads] [-a constant|poisson|bursty]
+//                [-b burst factor] [-r rates] [-d seconds] [-q max queue]
+//                [-s stop p99 ms] [-o curve.csv] <tflite model> [image.bmp...]
+//
+// rates is a list "10,20,40" or a sweep "start:stop:step" in frames per
+// second. Without images the input is synthetic. Bursty arrivals are Poisson
+// arrivals at burst factor times the rate during the first tenth of every
+// second, and slower for the rest, averaging to the rate.
+#include "TfLite.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+enum class Arrival { Constant, Poisson, Bursty };
+
+struct Request {
+    Clock::time_point arrival;
+    size_t input;
+};
+
+struct RateResult {
+    double offered = 0.0; // Frames per second.
+    double throughput = 0.0;
+    size_t completed = 0;
+    size_t dropped = 0;
+    double meanMs = 0.0;
+    double p50Ms = 0.0;
+    double p99Ms = 0.0;
+    double p999Ms = 0.0;
+    double maxMs = 0.0;
+};
+
+constexpr double BURST_FRACTION = 0.1; // Share of every second in a burst.
+
+vector<double> parseRates(const string &arg)
+{
+    vector<double> rates;
+    if (arg.find(':') != string::npos) {
+        double start, stop, step;
+        if (sscanf(arg.c_str(), "%lf:%lf:%lf", &start, &stop, &step) != 3 ||
+            step <= 0.0)
+            errExit("Invalid rate sweep " + arg + ", expected start:stop:step");
+        for (double r = start; r <= stop + 1e-9; r += step)
+            rates.push_back(r);
+        return rates;
+    }
+
+    size_t pos = 0;
+    while (pos < arg.size()) {
+        size_t comma = arg.find(',', pos);
+        rates.push_back(stod(arg.substr(pos, comma - pos)));
+        pos = comma == string::npos ? arg.size() : comma + 1;
+    }
+    return rates;
+}
+
+Arrival parseArrival(const string &name)
+{
+    if (name == "constant")
+        return Arrival::Constant;
+    if (name == "poisson")
+        return Arrival::Poisson;
+    if (name == "bursty")
+        return Arrival::Bursty;
+    errExit("Unknown arrival process " + name);
+    return Arrival::Constant;
+}
+
+double percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t idx = min(sorted.size() - 1,
+                     static_cast<size_t>(p / 100.0 * sorted.size()));
+    return sorted[idx];
+}
+
+class LoadGenerator {
+  public:
+    LoadGenerator(const char *modelFile, size_t workers, int threads,
+                  const vector<string> &images)
+    {
+        shared_ptr<tflite::FlatBufferModel> model;
+        for (size_t i = 0; i < max<size_t>(workers, 1); ++i) {
+            auto tfLite = make_unique<TfLite>();
+            tfLite->setBackend(TfLite::Backend::Cpu);
+            tfLite->setNumThreads(threads);
+            if (model) {
+                tfLite->loadModel(model);
+            }
+            else {
+                tfLite->loadModel(modelFile);
+                model = tfLite->getModel();
+            }
+            mInterpreters.push_back(move(tfLite));
+        }
+
+        // Preprocess once, so requests only pay for copying the tensor in.
+        TfLite &first = *mInterpreters.front();
+        string error;
+        if (!images.empty() && !first.isImageModel(&error))
+            errExit(error);
+        for (const auto &image : images) {
+            first.loadBmpImage(image.c_str());
+            const TfLiteTensor *input = first.getInputTensor();
+            const uint8_t *data = reinterpret_cast<uint8_t *>(input->data.raw);
+            mInputs.emplace_back(data, data + input->bytes);
+        }
+        if (mInputs.empty()) {
+            vector<uint8_t> synthetic(first.getInputTensor()->bytes);
+            mt19937 random(42);
+            for (auto &b : synthetic)
+                b = random() & 0x3f; // Small enough to be a sane float too.
+            mInputs.push_back(move(synthetic));
+        }
+
+        for (auto &tfLite : mInterpreters) {
+            tfLite->loadInput(mInputs[0].data(), mInputs[0].size());
+            tfLite->invoke();
+        }
+    }
+
+    RateResult run(double rate, Arrival arrival, double burstFactor,
+                   double seconds, size_t maxQueue)
+    {
+        mLatencies.assign(mInterpreters.size(), {});
+        mDone = false;
+        vector<thread> workers;
+        for (size_t i = 0; i < mInterpreters.size(); ++i)
+            workers.emplace_back(&LoadGenerator::workerLoop, this, i);
+
+        RateResult result;
+        result.offered = rate;
+        result.dropped =
+            generate(rate, arrival, burstFactor, seconds, maxQueue);
+        {
+            lock_guard<mutex> lock(mMutex);
+            mDone = true;
+        }
+        mCond.notify_all();
+        for (auto &w : workers)
+            w.join();
+
+        vector<double> all;
+        for (const auto &l : mLatencies)
+            all.insert(all.end(), l.begin(), l.end());
+        sort(all.begin(), all.end());
+        result.completed = all.size();
+        chrono::duration<double> elapsed = mLastCompletion - mStart;
+        result.throughput = elapsed.count() > 0.0 ? all.size() / elapsed.count()
+                                                  : 0.0;
+        for (double l : all)
+            result.meanMs += l;
+        result.meanMs /= max<size_t>(all.size(), 1);
+        result.p50Ms = percentile(all, 50);
+        result.p99Ms = percentile(all, 99);
+        result.p999Ms = percentile(all, 99.9);
+        result.maxMs = all.empty() ? 0.0 : all.back();
+        return result;
+    }
+
+  private:
+    // Enqueues requests on the arrival schedule. Returns the number dropped
+    // because the queue was full.
+    size_t generate(double rate, Arrival arrival, double burstFactor,
+                    double seconds, size_t maxQueue)
+    {
+        mt19937_64 random(1234);
+        const double burstRate = rate * burstFactor;
+        const double quietRate = rate * max(0.0, 1.0 - BURST_FRACTION *
+                                                          burstFactor) /
+                                 (1.0 - BURST_FRACTION);
+
+        mStart = mLastCompletion = Clock::now();
+        const auto end =
+            mStart + chrono::duration_cast<Clock::duration>(
+                         chrono::duration<double>(seconds));
+        double t = 0.0; // Seconds since start of the next arrival.
+        size_t dropped = 0;
+        size_t next = 0;
+        while (true) {
+            double currentRate = rate;
+            if (arrival == Arrival::Bursty)
+                currentRate = t - floor(t) < BURST_FRACTION ? burstRate
+                                                            : quietRate;
+            if (currentRate <= 0.0) {
+                t = floor(t) + 1.0; // Nothing until the next burst.
+                continue;
+            }
+            if (arrival == Arrival::Constant)
+                t += 1.0 / currentRate;
+            else
+                t += exponential_distribution<double>(currentRate)(random);
+
+            auto arrivalTime = mStart + chrono::duration_cast<Clock::duration>(
+                                            chrono::duration<double>(t));
+            if (arrivalTime >= end)
+                break;
+            this_thread::sleep_until(arrivalTime);
+
+            {
+                lock_guard<mutex> lock(mMutex);
+                if (mQueue.size() >= maxQueue) {
+                    ++dropped;
+                    continue;
+                }
+                // The scheduled time, not now: a late generator must not
+                // hide queueing (coordinated omission).
+                mQueue.push_back({arrivalTime, next++ % mInputs.size()});
+            }
+            mCond.notify_one();
+        }
+        return dropped;
+    }
+
+    void workerLoop(size_t worker)
+    {
+        TfLite &tfLite = *mInterpreters[worker];
+        while (true) {
+            Request request;
+            {
+                unique_lock<mutex> lock(mMutex);
+                mCond.wait(lock, [this] { return mDone || !mQueue.empty(); });
+                if (mQueue.empty())
+                    return;
+                request = mQueue.front();
+                mQueue.pop_front();
+            }
+
+            const vector<uint8_t> &input = mInputs[request.input];
+            tfLite.loadInput(input.data(), input.size());
+            tfLite.invoke();
+
+            auto now = Clock::now();
+            chrono::duration<double, milli> latency = now - request.arrival;
+            mLatencies[worker].push_back(latency.count());
+            lock_guard<mutex> lock(mMutex);
+            mLastCompletion = max(mLastCompletion, now);
+        }
+    }
+
+    vector<unique_ptr<TfLite>> mInterpreters;
+    vector<vector<uint8_t>> mInputs;
+    vector<vector<double>> mLatencies; // Per worker, no locking needed.
+
+    mutex mMutex;
+    condition_variable mCond;
+    deque<Request> mQueue;
+    bool mDone = false;
+    Clock::time_point mStart;
+    Clock::time_point mLastCompletion;
+};
+
+int main(int argc, char *argv[])
+{
+    size_t workers = 2;
+    int threads = 1;
+    Arrival arrival = Arrival::Poisson;
+    double burstFactor = 5.0;
+    vector<double> rates = {10.0};
+    double seconds = 10.0;
+    size_t maxQueue = 1000;
+    double stopP99 = 0.0;
+    string csvFile;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:t:a:b:r:d:q:s:o:")) != -1) {
+        switch (opt) {
+        case 'w':
+            workers = stoul(optarg);
+            break;
+        case 't':
+            threads = stoi(optarg);
+            break;
+        case 'a':
+            arrival = parseArrival(optarg);
+            break;
+        case 'b':
+            burstFactor = stod(optarg);
+            break;
+        case 'r':
+            rates = parseRates(optarg);
+            break;
+        case 'd':
+            seconds = stod(optarg);
+            break;
+        case 'q':
+            maxQueue = stoul(optarg);
+            break;
+        case 's':
+            stopP99 = stod(optarg);
+            break;
+        case 'o':
+            csvFile = optarg;
+            break;
+        default:
+            errExit("usage: loadgen [-w workers] [-t threads] "
+                    "[-a constant|poisson|bursty] [-b burst factor] "
+                    "[-r rates] [-d seconds] [-q max queue] [-s stop p99 ms] "
+                    "[-o curve.csv] <tflite model> [image.bmp ...]");
+        }
+    }
+    if (argc - optind < 1)
+        errExit("usage: loadgen [options] <tflite model> [image.bmp ...]");
+    if (arrival == Arrival::Bursty && burstFactor * BURST_FRACTION > 1.0)
+        errExit("The burst factor can be at most " +
+                to_string(1.0 / BURST_FRACTION));
+
+    vector<string> images(argv + optind + 1, argv + argc);
+    LoadGenerator generator(argv[optind], workers, threads, images);
+
+    ofstream csv;
+    if (!csvFile.empty()) {
+        csv.open(csvFile);
+        csv << "offered_fps,throughput_fps,completed,dropped,mean_ms,p50_ms,"
+               "p99_ms,p999_ms,max_ms\n";
+    }
+
+    cout << setw(9) << "offered" << setw(11) << "throughput" << setw(9)
+         << "dropped" << setw(9) << "mean ms" << setw(9) << "p50" << setw(9)
+         << "p99" << setw(9) << "p99.9" << setw(9) << "max" << "\n";
+    cout << fixed << setprecision(1);
+    for (double rate : rates) {
+        RateResult r =
+            generator.run(rate, arrival, burstFactor, seconds, maxQueue);
+        cout << setw(9) << r.offered << setw(11) << r.throughput << setw(9)
+             << r.dropped << setw(9) << r.meanMs << setw(9) << r.p50Ms
+             << setw(9) << r.p99Ms << setw(9) << r.p999Ms << setw(9)
+             << r.maxMs << endl;
+        if (csv)
+            csv << r.offered << "," << r.throughput << "," << r.completed
+                << "," << r.dropped << "," << r.meanMs << "," << r.p50Ms
+                << "," << r.p99Ms << "," << r.p999Ms << "," << r.maxMs << "\n";
+
+        if (stopP99 > 0.0 && r.p99Ms > stopP99) {
+            cout << "p99 over " << stopP99 << " ms, stopping the sweep.\n";
+            break;
+        }
+    }
+
+    return 0;
+}
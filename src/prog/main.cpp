@@ -5,160 +5,327 @@
 #include "opencv2/imgproc/types_c.h"
 #include "opencv2/opencv.hpp"
 
+#include "CadenceController.h"
+#include "Detections.h"
+#include "FramePyramid.h"
+#include "FrameRecorder.h"
+#include "Metrics.h"
+#include "ModelLadder.h"
+#include "Overlay.h"
 #include "TfLite.h"
+#include "Topology.h"
+#include "Trace.h"
+#include "Tracker.h"
+#include "TripleBuffer.h"
 #include "bmp.h"
 #include "utils.h"
 
+#include <condition_variable>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 using namespace std;
 
-void runImageClassification(const cv::Mat &frame)
+// Read from IZU_AFFINITY, e.g. "capture=0 inference=2-5 node=0".
+static ThreadPlacement placement;
+
+// Runs on the capture thread, from the pyramid level detection shares.
+vector<pair<float, int>> runImageClassification(TfLite &tfLite,
+                                                FramePyramid &pyramid)
 {
     TIMER
-    static bool initialized = false;
-    static TfLite tfLite;
-
-    if (!initialized) {
-        tfLite.loadModel("res/mobilenet_v2_1.0_224_quant.tflite");
-        tfLite.setInputBmpExport(false);
-        initialized = true;
-    }
 
-    tfLite.runInference(frame);
+    vector<int> dims = tfLite.getInputDims();
+    FramePyramid::View input = pyramid.get(cv::Size(dims[2], dims[1]));
+    tfLite.runInference(input.image());
+    return tfLite.getTopResults(1, TfLite::TOP_THRESHOLD);
 }
 
-vector<TfLiteTensor *> runObjectDetection(cv::Mat &frame)
+vector<TfLiteTensor *> runObjectDetection(TfLite &tfLite,
+                                          const cv::Mat &frame, int threads)
 {
     TIMER
 
-    static bool initialized = false;
-    static TfLite tfLite;
-
-    if (!initialized) {
-        tfLite.loadModel("res/detect.tflite");
-        tfLite.printInputOutputInfo();
-        tfLite.setInputBmpExport(false);
-        initialized = true;
-    }
+    // A reloaded model starts out with the thread count it was loaded with.
+    if (threads != tfLite.getNumThreads())
+        tfLite.setNumThreads(threads);
 
     tfLite.runInference(frame);
 
     return tfLite.getOutputs();
 }
 
-vector<string> createClassMap(const string &classesFile)
+void postProcessing(cv::Mat &frame, const Detections &detections)
 {
     TIMER
 
-    ifstream file(classesFile);
-    string line;
-    vector<string> classesMap;
-    while (getline(file, line)) {
-        classesMap.push_back(line);
-    }
+    static OverlayRenderer overlay("res/coco-labels-paper.txt");
+    const static float MIN_SCORE = 0.5;
 
-    return classesMap;
+    // Add boxes around detections with a score above MIN_SCORE.
+    overlay.draw(frame, detections, MIN_SCORE);
 }
 
-void postProcessing(cv::Mat &frame, vector<TfLiteTensor *> &output)
-{
-    TIMER
+// Runs detection on the latest offered frame and publishes the decoded and
+// tracked results, so rendering never waits for Invoke().
+class DetectionWorker {
+  public:
+    // Returns once the ladder's models are loaded.
+    DetectionWorker(CadenceController &cadence, ModelLadder &ladder,
+                    MetricsRegistry &metrics)
+        : mCadence(cadence), mLadder(ladder),
+          mInferred(metrics.counter("izu_frames_inferred_total",
+                                    "Frames that were inferred.")),
+          mDropped(metrics.counter(
+              "izu_frames_dropped_total",
+              "Offered frames replaced before inference started.")),
+          mQueued(metrics.gauge("izu_queued_frames",
+                                "Frames waiting for the detector.")),
+          mInferenceTime(metrics.histogram("izu_inference_seconds",
+                                           "Duration of one detection.")),
+          mLatency(metrics.histogram("izu_frame_latency_seconds",
+                                     "Capture to detection latency.")),
+          mThread(&DetectionWorker::loop, this)
+    {
+        metrics.gaugeFunction(
+            "izu_interpreter_utilisation",
+            "Fraction of time spent detecting since the last scrape.",
+            utilisationOf(mInferenceTime, 1.0));
+        mLoaded.get_future().wait();
+    }
+    ~DetectionWorker()
+    {
+        {
+            lock_guard<mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCond.notify_one();
+        mThread.join();
+    }
 
-    // Here, we assume the output to be as in COCO SSD MobileNet v1: Four
-    // tensors that specify.
-    // 0. Locations: Multidimensional array of [10][4] floating point values
-    // between 0 and 1, the inner arrays representing bounding boxes in the form
-    // [top, left, bottom, right].
-    // 1. Classes: Array of 10 integers (output as floating point values) each
-    // indicating the index of a class label from the labels file.
-    // 2. Scores Array of 10 floating point values between 0 and 1 representing
-    // probability that a class was detected.
-    // 3. Number and detections Array of length 1 containing a floating point
-    // value expressing the total number of detection results.
-
-    if (output[1]->type != kTfLiteFloat32) {
-        errExit("cannot handle output type " + to_string(output[1]->type) +
-                " yet");
-        exit(-1);
+    // Replaces any frame that the worker hasn't started on yet. The input is
+    // preprocessed for the given ladder rung.
+    void offer(FramePyramid::View input, size_t rung, uint64_t frameNr,
+               chrono::steady_clock::time_point captureTime)
+    {
+        {
+            lock_guard<mutex> lock(mMutex);
+            if (!mInput.empty())
+                mDropped.inc();
+            mQueued.set(1);
+            mInput = move(input);
+            mInputRung = rung;
+            mInputNr = frameNr;
+            mInputTime = captureTime;
+        }
+        mCond.notify_one();
     }
 
-    auto boxPtr = reinterpret_cast<const float *>(output[0]->data.data);
-    auto classPtr = reinterpret_cast<const float *>(output[1]->data.data);
-    auto scorePtr = reinterpret_cast<const float *>(output[2]->data.data);
-    static vector<string> classMap =
-        createClassMap("res/coco-labels-paper.txt");
+    const Detections &latest() { return mResults.read(); }
+    // Whether the last offered frame is still waiting.
+    bool pending()
+    {
+        lock_guard<mutex> lock(mMutex);
+        return !mInput.empty();
+    }
 
-    const static float MIN_SCORE = 0.5;
-    const cv::Scalar BOX_COLOR(0, 255, 0);
-    const cv::Scalar TEXT_COLOR(255, 255, 0);
-    const int FONT = cv::FONT_HERSHEY_SIMPLEX;
-    const double FONT_SCALE = 0.5;
+  private:
+    void loop()
+    {
+        traceThreadName("detection");
+        // TFLite's threads are spawned from here and inherit the placement.
+        pinCurrentThread(placement.inference);
+        preferMemoryNode(placement.memoryNode);
+
+        // Loaded here unless it is being watched, which the GL delegate needs.
+        if (!mLadder.rung(0).current()) {
+            mLadder.load();
+            mLadder.rung(0).current()->printInputOutputInfo();
+        }
+        mLoaded.set_value();
+
+        while (true) {
+            FramePyramid::View input;
+            size_t rung;
+            uint64_t frameNr;
+            chrono::steady_clock::time_point captureTime;
+            {
+                unique_lock<mutex> lock(mMutex);
+                mCond.wait(lock, [this] { return mStop || !mInput.empty(); });
+                if (mStop)
+                    return;
+                swap(input, mInput);
+                mQueued.set(0);
+                rung = mInputRung;
+                frameNr = mInputNr;
+                captureTime = mInputTime;
+            }
 
-    // Add boxes around detections with a score above MIN_SCORE.
-    size_t width = frame.cols;
-    size_t height = frame.rows;
-    for (size_t i = 0; i < 10; ++i) {
-        if (*(scorePtr + i) > MIN_SCORE) {
-            cv::Point topLeft(boxPtr[4 * i + 1] * width,
-                              boxPtr[4 * i] * height);
-            cv::Point bottomRight(boxPtr[4 * i + 3] * width,
-                                  boxPtr[4 * i + 2] * height);
-            cv::rectangle(frame, bottomRight, topLeft, BOX_COLOR);
-            int classId = static_cast<int>(classPtr[i]);
-            if (classId >= classMap.size()) {
-                cout << "[ERROR]: class id not found!\n";
+            // Holding the handle keeps the model alive even if a reload
+            // swaps in a new one meanwhile.
+            shared_ptr<TfLite> model = mLadder.rung(rung).current();
+            vector<int> dims = model->getInputDims();
+            const cv::Mat &image = input.image();
+            if (image.rows != dims[1] || image.cols != dims[2]) {
+                // Reloaded with another input size since it was offered.
+                mDropped.inc();
                 continue;
             }
-            cv::putText(frame, classMap[classId], topLeft, FONT, FONT_SCALE,
-                        TEXT_COLOR);
+
+            auto start = chrono::steady_clock::now();
+            Detections &detections = mResults.writeBuffer();
+            detections = decodeDetections(
+                runObjectDetection(*model, image, mCadence.threads()));
+            detections.frameNr = frameNr;
+            // Boxes are normalised, so tracks carry over between rungs.
+            mTracker.update(detections);
+            mResults.publish();
+
+            auto end = chrono::steady_clock::now();
+            chrono::duration<double, milli> inference = end - start;
+            chrono::duration<double, milli> latency = end - captureTime;
+            mCadence.recordInference(inference.count(), latency.count());
+            mLadder.recordInference(rung, inference.count(), latency.count());
+            mInferred.inc();
+            mInferenceTime.observe(inference.count() / 1000.0);
+            mLatency.observe(latency.count() / 1000.0);
         }
     }
-}
 
-void showWebCam()
+    CadenceController &mCadence;
+    ModelLadder &mLadder;
+    IouTracker mTracker;
+    promise<void> mLoaded;
+    Counter &mInferred;
+    Counter &mDropped;
+    Gauge &mQueued;
+    Histogram &mInferenceTime;
+    Histogram &mLatency;
+    TripleBuffer<Detections> mResults;
+    mutex mMutex;
+    condition_variable mCond;
+    FramePyramid::View mInput;
+    size_t mInputRung = 0;
+    uint64_t mInputNr = 0;
+    chrono::steady_clock::time_point mInputTime;
+    bool mStop = false;
+    thread mThread;
+};
+
+void showWebCam(CadenceController &cadence, ModelLadder &ladder,
+                MetricsRegistry &metrics, FrameRecorder *recorder,
+                const string &classifierFile)
 {
+    traceThreadName("capture");
+    pinCurrentThread(placement.captureAndPreprocess());
+    preferMemoryNode(placement.memoryNode);
+
     cv::VideoCapture cap;
     if (!cap.open(0 /* Default camera */))
         return;
 
     cv::namedWindow("Webcam");
-    cv::Mat frame, RGBframe, resized;
-    vector<TfLiteTensor *> output;
+    cv::Mat frame;
+    DetectionWorker detector(cadence, ladder, metrics);
+    // Preprocessing of every model running on the frame, best rung first.
+    FramePyramid pyramid;
+    for (size_t i = 0; i < ladder.size(); ++i)
+        pyramid.addSize(ladder.inputSize(i));
+    unique_ptr<TfLite> classifier;
+    vector<pair<float, int>> classes;
+    if (!classifierFile.empty()) {
+        classifier = make_unique<TfLite>();
+        classifier->setMemoryNode(placement.memoryNode);
+        classifier->loadModel(classifierFile.c_str());
+        string error;
+        if (!classifier->isImageModel(&error))
+            errExit(error);
+        vector<int> dims = classifier->getInputDims();
+        pyramid.addSize(cv::Size(dims[2], dims[1]));
+    }
+    Counter &captured =
+        metrics.counter("izu_frames_captured_total", "Frames read.");
+    Counter &skipped =
+        metrics.counter("izu_frames_skipped_total",
+                        "Frames not offered because of the stride.");
+    Histogram &frameTime = metrics.histogram(
+        "izu_frame_seconds", "Capture to display time of one frame.");
+    metrics.gaugeFunction("izu_inference_stride", "Frames per detection.",
+                          [&cadence] { return cadence.stride(); });
+    metrics.gaugeFunction("izu_interpreter_threads",
+                          "Threads of the interpreter.",
+                          [&cadence] { return cadence.threads(); });
+    metrics.gaugeFunction("izu_model_rung",
+                          "Model variant in use, 0 being the best.",
+                          [&ladder] { return ladder.current(); });
+    metrics.gaugeFunction("izu_model_switches",
+                          "Switches between model variants.",
+                          [&ladder] { return ladder.switches(); });
     size_t frame_nr = 0;
     for (;;) {
 #ifdef TIME
         Timer timer("1 frame");
 #endif
+        auto frameStart = chrono::steady_clock::now();
 
-        cap >> frame;
+        {
+            TRACE_SCOPE("capture")
+            cap >> frame;
+        }
         if (frame.empty())
             break;
-
-        if (frame_nr % 2 == 0) {
+        captured.inc();
+        if (recorder)
+            recorder->record(frame, "camera");
+        pyramid.setFrame(frame);
+
+        if (cadence.shouldInfer(frame_nr)) {
+            size_t rung = ladder.choose(detector.pending());
+            FramePyramid::View input;
 #ifdef TIME
         {
             Timer timer("pre-processing");
 #endif
-            cv::cvtColor(frame, RGBframe, CV_BGR2RGB);
-
-            cv::resize(RGBframe, resized, cv::Size(300, 300), 0, 0,
-                       cv::INTER_CUBIC);
+            input = pyramid.get(ladder.inputSize(rung));
 #ifdef TIME
         }
 #endif
-            output = runObjectDetection(resized);
+            // The pyramid won't reuse the buffer while the worker holds it.
+            detector.offer(move(input), rung, frame_nr, frameStart);
+            // Usually scaled from the level just made for detection.
+            if (classifier)
+                classes = runImageClassification(*classifier, pyramid);
+        }
+        else {
+            skipped.inc();
         }
 
-        postProcessing(frame, output);
-
-        cv::imshow("Webcam", frame);
+        postProcessing(frame, detector.latest());
 
-        if (cv::waitKey(10) == 27 /* ESC key */)
+        int key;
+        {
+            TRACE_SCOPE("display")
+            cv::imshow("Webcam", frame);
+            key = cv::waitKey(10);
+        }
+        if (key == 27 /* ESC key */)
             break;
 
+        chrono::duration<double, milli> frameMs =
+            chrono::steady_clock::now() - frameStart;
+        cadence.recordFrame(frameMs.count());
+        frameTime.observe(frameMs.count() / 1000.0);
+        if (frame_nr % 100 == 0) {
+            cadence.printMetrics();
+            if (classifier)
+                TfLite::printTopResults(classes);
+        }
+
         ++frame_nr;
     }
 }
@@ -167,7 +334,111 @@ int main(int argc, char **argv)
 {
     TIMER
 
-    showWebCam();
+    // Inference cadence targets:
+    // -f <fps>: render frame rate to hold.
+    // -l <ms>: capture to detection latency to hold. Adds interpreter threads
+    // with -t and offers fewer frames once that doesn't help.
+    // -t: let the controller change the interpreter's thread count. Only on
+    // the CPU backend, so it needs -w.
+    // Inference starts on every second frame and the controller adapts it.
+    // -r <n>: record every nth camera frame in the background.
+    // -m <model>: detection model, res/detect.tflite by default. Repeat it to
+    // give cheaper variants, best first, to switch to under load.
+    // -w: reload models when their files change. Runs on the CPU backend.
+    // -p <pages>: back the models' weights and tensor arenas with huge pages
+    // and/or prefault and lock them, e.g. "thp,prefault". Reloads too.
+    // -c <model>: also classify every inferred frame, e.g. with
+    // res/mobilenet_v2_1.0_224_quant.tflite. Shares the frame's resize and
+    // colour conversion with detection.
+    // -e <address>: serve metrics on "host:port" or "unix:/path".
+    // Set IZU_TRACE=<file.json> to record a timeline of the pipeline.
+    CadenceController::Config config;
+    unique_ptr<FrameRecorder> recorder;
+    vector<string> modelFiles;
+    bool watchModel = false;
+    string metricsAddress;
+    PageOptions pages;
+    string classifierFile;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:l:tr:m:wp:c:e:")) != -1) {
+        switch (opt) {
+        case 'f':
+            config.targetFps = stod(optarg);
+            break;
+        case 'l':
+            config.targetLatencyMs = stod(optarg);
+            break;
+        case 't':
+            config.adjustThreads = true;
+            config.maxThreads = max(1u, thread::hardware_concurrency());
+            break;
+        case 'r': {
+            FrameRecorder::Config recordConfig;
+            recordConfig.prefix = "webcam";
+            recordConfig.everyNth = stoul(optarg);
+            recorder = make_unique<FrameRecorder>(recordConfig);
+            break;
+        }
+        case 'm':
+            modelFiles.push_back(optarg);
+            break;
+        case 'w':
+            watchModel = true;
+            break;
+        case 'p':
+            pages = PageOptions::fromString(optarg);
+            break;
+        case 'c':
+            classifierFile = optarg;
+            break;
+        case 'e':
+            metricsAddress = optarg;
+            break;
+        default:
+            errExit("usage: main [-f fps] [-l latency ms] [-t] [-r n] "
+                    "[-m model] [-w] [-p pages] [-c model] [-e address]");
+        }
+    }
+
+    if (config.adjustThreads && !watchModel) {
+        cerr << "[WARNING]: -t is ignored without -w, the GPU delegate "
+                "doesn't use interpreter threads.\n";
+        config.adjustThreads = false;
+    }
+
+    placement = ThreadPlacement::fromEnv();
+    Topology::detect().print();
+    placement.print();
+
+    CadenceController cadence(config, 4);
+    ModelLadder::Config ladderConfig;
+    ladderConfig.targetLatencyMs = config.targetLatencyMs;
+    ModelLadder ladder(ladderConfig);
+    if (modelFiles.empty())
+        modelFiles.push_back("res/detect.tflite");
+    for (const auto &file : modelFiles)
+        ladder.addRung(file, [&](TfLite &tfLite) {
+            if (watchModel)
+                tfLite.setBackend(TfLite::Backend::Cpu);
+            tfLite.setNumThreads(cadence.threads());
+            tfLite.setMemoryNode(placement.memoryNode);
+            tfLite.setPageOptions(pages);
+        });
+    if (watchModel) {
+        // Loaded here rather than on the pinned detection thread.
+        {
+            ScopedAffinity pin(placement.inference);
+            ladder.load();
+        }
+        ladder.watch(500, placement.inference);
+    }
+
+    MetricsRegistry metrics;
+    unique_ptr<MetricsServer> metricsServer;
+    if (!metricsAddress.empty())
+        metricsServer = make_unique<MetricsServer>(metrics, metricsAddress);
+
+    showWebCam(cadence, ladder, metrics, recorder.get(), classifierFile);
 
     return 0;
 }
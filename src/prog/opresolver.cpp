@@ -0,0 +1,84 @@
+// Lists the ops used by one or more models as src/ReducedOps.inc for a
+// REDUCED_OPS build, which then only links and registers those kernels.
+//
+// usage: opresolver <tflite model>... > src/ReducedOps.inc
+#include "utils.h"
+
+#include <iostream>
+#include <map>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+struct VersionRange {
+    int min = 0;
+    int max = 0;
+
+    void add(int version)
+    {
+        min = min == 0 ? version : std::min(min, version);
+        max = std::max(max, version);
+    }
+};
+
+// Custom ops that BuiltinOpResolver registers, by custom code.
+const map<string, string> KNOWN_CUSTOM_OPS = {
+    {"TFLite_Detection_PostProcess", "DETECTION_POSTPROCESS"},
+    {"Mfcc", "MFCC"},
+    {"AudioSpectrogram", "AUDIO_SPECTROGRAM"},
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        errExit("usage: opresolver <tflite model>... > src/ReducedOps.inc");
+
+    map<string, VersionRange> builtins;
+    map<string, VersionRange> customs;
+    for (int i = 1; i < argc; ++i) {
+        auto model = tflite::FlatBufferModel::BuildFromFile(argv[i]);
+        if (!model)
+            errExit("Couldn't build model from " + string(argv[i]));
+
+        auto opCodes = model->GetModel()->operator_codes();
+        if (!opCodes)
+            continue;
+        for (const auto &opCode : *opCodes) {
+            int version = max(1, static_cast<int>(opCode->version()));
+            if (opCode->builtin_code() == tflite::BuiltinOperator_CUSTOM) {
+                string name = opCode->custom_code()
+                                  ? opCode->custom_code()->str()
+                                  : string();
+                if (!KNOWN_CUSTOM_OPS.count(name)) {
+                    cerr << "[WARNING]: " << argv[i] << " uses custom op \""
+                         << name << "\", register it by hand.\n";
+                    continue;
+                }
+                customs[name].add(version);
+            }
+            else {
+                builtins[tflite::EnumNameBuiltinOperator(
+                             opCode->builtin_code())]
+                    .add(version);
+            }
+        }
+    }
+
+    cout << "// Generated by opresolver from";
+    for (int i = 1; i < argc; ++i)
+        cout << " " << argv[i];
+    cout << ".\n";
+    for (const auto &[name, versions] : builtins)
+        cout << "IZU_BUILTIN_OP(" << name << ", " << versions.min << ", "
+             << versions.max << ")\n";
+    for (const auto &[name, versions] : customs)
+        cout << "IZU_CUSTOM_OP(\"" << name << "\", "
+             << KNOWN_CUSTOM_OPS.at(name) << ", " << versions.min << ", "
+             << versions.max << ")\n";
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Runs object detection on several camera/video streams with one shared model.
+//
+// usage: streams [-w workers] [-t threads] [-b batch] [-p priority|fair]
+//                [-a placement] [-e metrics address] <tflite model>
+//                <source>[@fps[:priority[:weight]]] ...
+//
+// The placement is e.g. "capture=0-1 inference=2-17 node=0" and defaults to
+// the IZU_AFFINITY environment variable. Metrics are served for Prometheus
+// on e.g. "127.0.0.1:9100" or "unix:/tmp/izu.sock".
+#include "StreamScheduler.h"
+#include "utils.h"
+
+#include <atomic>
+#include <csignal>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+static atomic<bool> interrupted{false};
+
+StreamConfig parseStream(const string &arg)
+{
+    StreamConfig config;
+    size_t at = arg.find('@');
+    config.source = arg.substr(0, at);
+    if (at == string::npos)
+        return config;
+
+    string rest = arg.substr(at + 1);
+    size_t colon = rest.find(':');
+    config.targetFps = stod(rest.substr(0, colon));
+    if (colon == string::npos)
+        return config;
+
+    rest = rest.substr(colon + 1);
+    colon = rest.find(':');
+    config.priority = stoi(rest.substr(0, colon));
+    if (colon != string::npos)
+        config.weight = stod(rest.substr(colon + 1));
+    return config;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t workers = 2;
+    int threads = 2;
+    size_t batch = 1;
+    StreamScheduler::Policy policy = StreamScheduler::Policy::FairShare;
+    ThreadPlacement placement = ThreadPlacement::fromEnv();
+    string metricsAddress;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:t:b:p:a:e:")) != -1) {
+        switch (opt) {
+        case 'w':
+            workers = stoul(optarg);
+            break;
+        case 't':
+            threads = stoi(optarg);
+            break;
+        case 'b':
+            batch = stoul(optarg);
+            break;
+        case 'p':
+            policy = string(optarg) == "priority"
+                         ? StreamScheduler::Policy::Priority
+                         : StreamScheduler::Policy::FairShare;
+            break;
+        case 'a':
+            placement = ThreadPlacement::fromString(optarg);
+            break;
+        case 'e':
+            metricsAddress = optarg;
+            break;
+        default:
+            errExit("usage: streams [-w workers] [-t threads] [-b batch] "
+                    "[-p priority|fair] [-a placement] [-e address] "
+                    "<tflite model> <source>[@fps[:priority[:weight]]] ...");
+        }
+    }
+    if (argc - optind < 2)
+        errExit("usage: streams [options] <tflite model> <source> ...");
+
+    Topology::detect().print();
+    placement.print();
+
+    StreamScheduler scheduler;
+    scheduler.setThreadPlacement(placement);
+    scheduler.loadModel(argv[optind], workers, threads);
+    scheduler.setPolicy(policy);
+    scheduler.setMaxBatch(batch);
+    for (int i = optind + 1; i < argc; ++i)
+        scheduler.addStream(parseStream(argv[i]));
+
+    unique_ptr<MetricsServer> metricsServer;
+    if (!metricsAddress.empty())
+        metricsServer =
+            make_unique<MetricsServer>(scheduler.metrics(), metricsAddress);
+
+    signal(SIGINT, [](int) { interrupted = true; });
+    scheduler.start();
+    while (!interrupted) {
+        this_thread::sleep_for(chrono::seconds(5));
+        scheduler.printStats();
+    }
+    scheduler.stop();
+    scheduler.printStats();
+
+    return 0;
+}
@@ -1,24 +1,196 @@
+// Classifies one or more BMP images.
+//
+// usage: tflitex [-c cache] [-w cache] [-n] [-r results] [-p pages]
+//                [-i depth] [-d] <tflite model> <input>...
+//
+// -c reads preprocessed input tensors from a tensor cache, falling back to
+//    decoding and resizing inputs that aren't in it.
+// -w writes the preprocessed input tensors of this run to a new cache.
+// -n trusts cached paths and skips hashing the source images.
+// -r looks results up in a result cache before doing any work, and adds new
+//    ones to it. Entries are keyed by model, preprocessing and image content.
+// -p backs the weights and tensor arenas with huge pages and/or prefaults and
+//    locks them, e.g. "thp,lock" or "explicit,prefault". Compare the page
+//    fault report at the end with a run without it.
+// -i reads inputs ahead with up to depth reads in flight, through io_uring
+//    when built with IO_URING=1, and scores them in the order they arrive.
+// -d reads inputs ahead with O_DIRECT, bypassing the page cache.
+#include "ImageReader.h"
+#include "ResultCache.h"
+#include "TensorCache.h"
 #include "TfLite.h"
+#include "Topology.h"
 #include "utils.h"
 
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
 using namespace std;
 
-void runInference(const char *modelFile, const char *inputFile)
+// Everything besides the model and image that the top results depend on.
+uint64_t preprocessHash(const TfLite &tfLite)
 {
-    TfLite tfLite;
-    tfLite.loadModel(modelFile);
-    tfLite.runInference(inputFile);
+    ostringstream config;
+    config << "resize_bilinear type=" << tfLite.getInputTensor()->type
+           << " dims=";
+    for (int d : tfLite.getInputDims())
+        config << d << ",";
+    config << " dequantized top=" << TfLite::TOP_RESULTS
+           << " threshold=" << TfLite::TOP_THRESHOLD;
+    string s = config.str();
+    return hashBytes(s.data(), s.size());
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
-        errExit("usage: <tflite model>\n");
+    string readCache;
+    string writeCache;
+    string resultFile;
+    bool verify = true;
+    PageOptions pages;
+    ImageReader::Config readConfig;
+    readConfig.depth = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:w:nr:p:i:d")) != -1) {
+        switch (opt) {
+        case 'c':
+            readCache = optarg;
+            break;
+        case 'w':
+            writeCache = optarg;
+            break;
+        case 'n':
+            verify = false;
+            break;
+        case 'r':
+            resultFile = optarg;
+            break;
+        case 'p':
+            pages = PageOptions::fromString(optarg);
+            break;
+        case 'i':
+            readConfig.depth = stoul(optarg);
+            break;
+        case 'd':
+            readConfig.direct = true;
+            break;
+        default:
+            errExit("usage: tflitex [-c cache] [-w cache] [-n] [-r results] "
+                    "[-p pages] [-i depth] [-d] <tflite model> <input>...");
+        }
+    }
+    if (argc - optind < 2)
+        errExit("usage: tflitex [-c cache] [-w cache] [-n] [-r results] "
+                "[-p pages] [-i depth] [-d] <tflite model> <input>...");
+
+    PageFaults start = PageFaults::now();
+    TfLite tfLite;
+    tfLite.setPageOptions(pages);
+    tfLite.loadModel(argv[optind]);
+    string error;
+    if (!tfLite.isImageModel(&error))
+        errExit(error);
+    PageFaults loadFaults = PageFaults::now() - start;
+    tfLite.printInputOutputInfo();
+
+    TensorCache cache;
+    if (!readCache.empty() && !cache.open(readCache))
+        cerr << "[WARNING]: Couldn't open tensor cache " << readCache << "\n";
+    unique_ptr<TensorCacheWriter> writer;
+    if (!writeCache.empty())
+        writer = make_unique<TensorCacheWriter>(writeCache);
+
+    unique_ptr<ResultCache> results;
+    ResultKey resultKey;
+    if (!resultFile.empty()) {
+        results = make_unique<ResultCache>(resultFile);
+        resultKey.modelHash = hashFile(argv[optind]);
+        resultKey.preprocessHash = preprocessHash(tfLite);
+    }
 
-    const char *modelFile = argv[1];
-    const char *inputFile = argv[2];
+    const vector<int> dims = tfLite.getInputDims();
+    size_t hits = 0;
+    size_t resultHits = 0;
+    size_t invokes = 0;
+    PageFaults firstFaults, laterFaults;
+    // The file's contents are null unless it was read ahead.
+    auto score = [&](const char *path, const uint8_t *data, size_t bytes) {
+        TensorKey key;
+        key.path = path;
+        key.dims = dims;
+        key.type = tfLite.getInputTensor()->type;
+        if (verify || writer || results)
+            key.contentHash = data ? hashBytes(data, bytes) : hashFile(path);
 
-    runInference(modelFile, inputFile);
+        resultKey.imageHash = key.contentHash;
+        if (const ResultCache::Results *top =
+                results ? results->find(resultKey) : nullptr) {
+            cout << "\n" << path << ":";
+            TfLite::printTopResults(*top);
+            ++resultHits;
+            return;
+        }
+
+        const TensorCache::Tensor *cached =
+            verify ? cache.find(key) : cache.find(key.path, dims, key.type);
+        if (cached) {
+            tfLite.loadInput(cached->data, cached->bytes);
+            ++hits;
+        }
+        else if (data) {
+            tfLite.loadBmpImage(data, bytes);
+        }
+        else {
+            tfLite.loadBmpImage(path);
+        }
+
+        if (writer) {
+            const TfLiteTensor *input = tfLite.getInputTensor();
+            writer->add(key, input->data.raw, input->bytes);
+        }
+
+        PageFaults before = PageFaults::now();
+        tfLite.invoke();
+        PageFaults faults = PageFaults::now() - before;
+        PageFaults &total = invokes++ == 0 ? firstFaults : laterFaults;
+        total.minor += faults.minor;
+        total.major += faults.major;
+
+        ResultCache::Results top =
+            tfLite.getTopResults(TfLite::TOP_RESULTS, TfLite::TOP_THRESHOLD);
+        if (results)
+            results->add(resultKey, top);
+        cout << "\n" << path << ":";
+        TfLite::printTopResults(top);
+    };
+
+    if (readConfig.depth > 0) {
+        vector<string> inputs(argv + optind + 1, argv + argc);
+        ImageReader reader(inputs, readConfig);
+        ImageReader::File file;
+        while (reader.next(file)) {
+            score(inputs[file.index].c_str(), file.data, file.size);
+            reader.release(file);
+        }
+    }
+    else {
+        for (int i = optind + 1; i < argc; ++i)
+            score(argv[i], nullptr, 0);
+    }
+
+    if (!readCache.empty())
+        cout << "\nTensor cache: " << hits << " of " << argc - optind - 1
+             << " inputs cached\n";
+    if (results)
+        cout << "Result cache: " << resultHits << " of " << argc - optind - 1
+             << " results cached\n";
+    cout << "Page faults (minor/major): load " << loadFaults.minor << "/"
+         << loadFaults.major << ", first Invoke() " << firstFaults.minor << "/"
+         << firstFaults.major << ", " << (invokes > 1 ? invokes - 1 : 0)
+         << " later Invoke()s " << laterFaults.minor << "/"
+         << laterFaults.major << "\n";
 
     return 0;
-}
\ No newline at end of file
+}
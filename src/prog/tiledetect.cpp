@@ -0,0 +1,90 @@
+// Runs tiled object detection on a large image and prints the detections.
+//
+// usage: tiledetect [-o overlap] [-s tile scale] [-w workers] [-t threads]
+//                   [-m min score] [-L labels] [-O annotated.png]
+//                   <tflite model> <image>
+#include "TiledDetector.h"
+#include "utils.h"
+
+#include <iostream>
+#include <unistd.h>
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    TilingConfig config;
+    size_t workers = 4;
+    int threads = 1;
+    string labelsFile = "res/coco-labels-paper.txt";
+    string outFile;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:s:w:t:m:L:O:")) != -1) {
+        switch (opt) {
+        case 'o':
+            config.overlap = stod(optarg);
+            break;
+        case 's':
+            config.tileScale = stod(optarg);
+            break;
+        case 'w':
+            workers = stoul(optarg);
+            break;
+        case 't':
+            threads = stoi(optarg);
+            break;
+        case 'm':
+            config.minScore = stof(optarg);
+            break;
+        case 'L':
+            labelsFile = optarg;
+            break;
+        case 'O':
+            outFile = optarg;
+            break;
+        default:
+            errExit("usage: tiledetect [options] <tflite model> <image>");
+        }
+    }
+    if (argc - optind != 2)
+        errExit("usage: tiledetect [options] <tflite model> <image>");
+
+    cv::Mat image = cv::imread(argv[optind + 1]);
+    if (image.empty())
+        errExit("Couldn't read image " + string(argv[optind + 1]));
+
+    TiledDetector detector;
+    detector.loadModel(argv[optind], workers, threads);
+    vector<Detection> detections = detector.detect(image, config);
+
+    vector<string> labels;
+    size_t labelCount;
+    ReadLabelsFile(labelsFile, &labels, &labelCount);
+
+    cout << detections.size() << " detections:\n";
+    for (const auto &d : detections) {
+        int x0 = d.box.left * image.cols;
+        int y0 = d.box.top * image.rows;
+        int x1 = d.box.right * image.cols;
+        int y1 = d.box.bottom * image.rows;
+        string label = d.classId >= 0 && d.classId < (int)labelCount
+                           ? labels[d.classId]
+                           : to_string(d.classId);
+        cout << d.score << ": " << label << " [" << x0 << ", " << y0 << ", "
+             << x1 << ", " << y1 << "]\n";
+
+        if (!outFile.empty()) {
+            cv::rectangle(image, cv::Point(x0, y0), cv::Point(x1, y1),
+                          cv::Scalar(0, 255, 0), 2);
+            cv::putText(image, label, cv::Point(x0, y0),
+                        cv::FONT_HERSHEY_SIMPLEX, 0.5,
+                        cv::Scalar(255, 255, 0));
+        }
+    }
+
+    if (!outFile.empty())
+        cv::imwrite(outFile, image);
+
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include "utils.h"
+#include "MappedFile.h"
+#include "Trace.h"
 #include "bmp.h"
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -12,6 +15,65 @@ void errExit(const string_view &msg)
     exit(-1);
 }
 
+namespace {
+
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+
+inline uint64_t rotl(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+inline uint64_t mixWord(uint64_t lane, uint64_t word)
+{
+    return rotl(lane + word * PRIME2, 31) * PRIME1;
+}
+
+inline uint64_t loadWord(const uint8_t *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+} // namespace
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint8_t *end = p + size;
+
+    // Four independent lanes over 32 byte blocks keep the multipliers busy.
+    uint64_t lanes[4] = {seed + PRIME1 + PRIME2, seed + PRIME2, seed,
+                         seed - PRIME1};
+    for (; end - p >= 32; p += 32)
+        for (int i = 0; i < 4; ++i)
+            lanes[i] = mixWord(lanes[i], loadWord(p + 8 * i));
+
+    uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) +
+                 rotl(lanes[3], 18) + size;
+    for (; end - p >= 8; p += 8)
+        h = rotl(h ^ mixWord(0, loadWord(p)), 27) * PRIME1 + PRIME2;
+    for (; p < end; ++p)
+        h = rotl(h ^ (*p * PRIME1), 11) * PRIME2;
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME1;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hashFile(const char *file)
+{
+    MappedFile mapped;
+    if (!mapped.open(file))
+        errExit("Couldn't map " + string(file) + " for hashing.");
+    return hashBytes(mapped.data(), mapped.size());
+}
+
 void ReadLabelsFile(const string &file_name, std::vector<string> *result,
                     size_t *found_label_count)
 {
@@ -69,19 +131,30 @@ void paintRow(cv::Mat &frame, int row, int color)
         }
 }
 
-Timer::Timer() : mMessage("Timer:")
+Timer::Timer() : Timer("Timer:") {}
+
+Timer::Timer(const char *msg) : mMessage(msg), mTraceName(msg)
 {
+    if (traceEnabled())
+        traceBegin(mTraceName);
     mStart = std::chrono::steady_clock::now();
 }
 
 Timer::Timer(std::string &&msg) : mMessage(msg)
 {
+    if (traceEnabled()) {
+        mTraceName = traceIntern(mMessage);
+        traceBegin(mTraceName);
+    }
     mStart = std::chrono::steady_clock::now();
 }
 
 Timer::~Timer()
 {
-  printDuration();
+    if (traceEnabled())
+        traceEnd(mTraceName);
+    else
+        printDuration();
 }
 
 void Timer::printDuration() const
@@ -11,11 +11,21 @@
 #include <queue>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <vector>
 
 void errExit(const std::string_view &msg);
 
-// Resizes image data by using the "resize" builtin operator in tflite.
+namespace tflite {
+namespace ops {
+namespace builtin {
+TfLiteRegistration *Register_RESIZE_BILINEAR();
+} // namespace builtin
+} // namespace ops
+} // namespace tflite
+
+// Resizes image data by using the "resize" builtin operator in tflite, and
+// converts it to a float, uint8 or int8 input tensor.
 template <class T>
 void resize(T *out, uint8_t *in, int image_height, int image_width,
             int image_channels, int wanted_height, int wanted_width,
@@ -39,10 +49,10 @@ void resize(T *out, uint8_t *in, int image_height, int image_width,
         2, kTfLiteFloat32, "output",
         {1, wanted_height, wanted_width, wanted_channels}, quant);
 
-    // Add the custom op that does the resizing.
-    tflite::ops::builtin::BuiltinOpResolver resolver;
-    const TfLiteRegistration *resize_op = resolver.FindOp(
-        tflite::BuiltinOperator::BuiltinOperator_RESIZE_BILINEAR, 1);
+    // Add the op that does the resizing. Taken from its kernel directly rather
+    // than from a resolver that would register every builtin op per call.
+    const TfLiteRegistration *resize_op =
+        tflite::ops::builtin::Register_RESIZE_BILINEAR();
     // params is freed in AddNodeWithParameters().
     auto *params = reinterpret_cast<TfLiteResizeBilinearParams *>(
         malloc(sizeof(TfLiteResizeBilinearParams)));
@@ -68,25 +78,31 @@ void resize(T *out, uint8_t *in, int image_height, int image_width,
 
     // Fill out with the output data.
     auto output = interpreter->typed_tensor<float>(2);
-    bool floating = std::is_same_v<T, float>;
     static const float input_mean = 0.;
     static const float input_std = 1.;
     auto output_number_of_pixels =
         wanted_height * wanted_width * wanted_channels;
     for (int i = 0; i < output_number_of_pixels; i++) {
-        if (floating)
+        if constexpr (std::is_same_v<T, float>) {
             out[i] = (output[i] - input_mean) / input_std;
-        else
+        }
+        else if constexpr (std::is_same_v<T, uint8_t>) {
             out[i] = (uint8_t)output[i];
+        }
+        else {
+            static_assert(std::is_same_v<T, int8_t>, "Unsupported input type");
+            out[i] = (int8_t)(output[i] - 128.f);
+        }
     }
 }
 
 // Returns the top N confidence values over threshold in the provided vector,
-// sorted by confidence in descending order.
+// sorted by confidence in descending order. Quantised scores are dequantised
+// with the output's params, or mapped to [0, 1] if it has none (scale 0).
 template <class T>
 void get_top_n(T *prediction, int prediction_size, size_t num_results,
                float threshold, std::vector<std::pair<float, int>> *top_results,
-               bool input_floating)
+               TfLiteQuantizationParams quant = {0.f, 0})
 {
     // Will contain top N results in ascending order.
     std::priority_queue<std::pair<float, int>,
@@ -94,13 +110,22 @@ void get_top_n(T *prediction, int prediction_size, size_t num_results,
                         std::greater<std::pair<float, int>>>
         top_result_pq;
 
+    static_assert(std::is_same_v<T, float> || std::is_same_v<T, uint8_t> ||
+                      std::is_same_v<T, int8_t>,
+                  "Unsupported output type");
+    // Picked once, so the loop has no branch on it.
+    if (quant.scale <= 0.f) {
+        quant.scale = 1.f / 255;
+        quant.zero_point = std::is_same_v<T, int8_t> ? -128 : 0;
+    }
+
     const long count = prediction_size; // NOLINT(runtime/int)
     for (int i = 0; i < count; ++i) {
         float value;
-        if (input_floating)
+        if constexpr (std::is_same_v<T, float>)
             value = prediction[i];
         else
-            value = prediction[i] / 255.0;
+            value = quant.scale * (prediction[i] - quant.zero_point);
         // Only add it if it beats the threshold and has a chance at being in
         // the top N.
         if (value < threshold) {
@@ -123,6 +148,11 @@ void get_top_n(T *prediction, int prediction_size, size_t num_results,
     std::reverse(top_results->begin(), top_results->end());
 }
 
+// Fast non-cryptographic 64 bit hash, for cache keys and change detection.
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+// Hashes a file's contents through a memory mapping of it.
+uint64_t hashFile(const char *file);
+
 void ReadLabelsFile(const std::string &file_name,
                     std::vector<std::string> *result,
                     size_t *found_label_count);
@@ -131,10 +161,12 @@ void ReadLabelsFile(const std::string &file_name,
 void printFrameInfo(cv::Mat &frame);
 void paintRow(cv::Mat &frame, int row, int color);
 
-// Prints the time since construction at time of destruction.
+// Prints the time since construction at time of destruction, or records the
+// scope as a trace event when tracing is enabled (see Trace.h).
 class Timer {
   public:
     Timer();
+    Timer(const char *msg);
     Timer(std::string &&msg);
     ~Timer();
 
@@ -143,6 +175,7 @@ class Timer {
   private:
     std::chrono::steady_clock::time_point mStart;
     std::string mMessage;
+    const char *mTraceName = nullptr;
 };
 
 // Convenience macro for timing a function.